@@ -0,0 +1,194 @@
+#ifndef BASCHEDULER_HPP
+#define BASCHEDULER_HPP
+
+#include <algorithm>
+#include <limits>
+#include <ros/ros.h>
+#include <ollieRosTools/VoNode_paramsConfig.h>
+#include <ollieRosTools/aux.hpp>
+
+
+
+/// Decides per new keyframe whether to run a local BA (the newest g2o_localWindow keyframes), a global BA or none.
+///  - The reprojection error of each new keyframe is compared against the per observation error left after the last BA.
+///    As long as it has not grown by ba_growthLocal, BA is skipped. Growth beyond ba_growthGlobal asks for a global BA.
+///  - Global BA is only run if its running average cost fits the BA time budget, else it is downgraded to local.
+///    It is also run every ba_globalEvery keyframes so the whole map is adjusted now and then.
+///  - Background BA may only use ba_maxLoad of the wall time (BA time / time between BA starts, running average).
+///  - After ba_maxSkip keyframes without BA a local one is forced.
+/// The iteration deadline and convergence stop are g2o_budget and g2o_gain, applied by the solvers.
+/// When off every keyframe gets the configured BA, as before.
+class BAScheduler {
+public:
+    enum Decision {BA_NONE=0, BA_LOCAL=1, BA_GLOBAL=2};
+
+    BAScheduler():
+        on(false),
+        growthLocal(1.5),
+        growthGlobal(4),
+        globalEvery(10),
+        maxSkip(5),
+        maxLoad(0.5),
+        budget(0),
+        alpha(0.8),
+        baseline(-1),
+        errorSum(0),
+        errorNr(0),
+        kfsSinceBA(0),
+        kfsSinceGlobal(0),
+        costLocal(0),
+        costGlobal(0),
+        load(0),
+        lastRatio(-1),
+        lastDecision(BA_NONE),
+        lastReason("none"),
+        nrNone(0),
+        nrLocal(0),
+        nrGlobal(0){
+    }
+
+    /// Call once per new keyframe with the mean squared reprojection error of its observations (<0 if unknown).
+    /// busy: a background BA is still running
+    Decision decide(const double kfError, const bool busy){
+        ++kfsSinceBA;
+        ++kfsSinceGlobal;
+        if (kfError>=0){
+            errorSum += kfError;
+            ++errorNr;
+        }
+        lastRatio = (baseline>0 && errorNr>0) ? errorSum/errorNr/baseline : std::numeric_limits<double>::infinity();
+
+        if (!on){
+            return decided(BA_LOCAL, "scheduler off");
+        }
+        if (busy){
+            return decided(BA_NONE, "busy");
+        }
+
+        const bool forced = kfsSinceBA > maxSkip;
+        if (!forced && load>maxLoad){
+            return decided(BA_NONE, "cpu load");
+        }
+        if (!forced && lastRatio<growthLocal){
+            return decided(BA_NONE, "error small");
+        }
+
+        const bool wantGlobal = lastRatio>=growthGlobal || (globalEvery>0 && kfsSinceGlobal>=globalEvery);
+        if (wantGlobal){
+            if (budget<=0 || costGlobal<=budget){
+                return decided(BA_GLOBAL, lastRatio>=growthGlobal ? "error growth" : "periodic");
+            }
+            return decided(BA_LOCAL, "global over budget");
+        }
+        return decided(BA_LOCAL, forced ? "forced" : "error growth");
+    }
+
+    /// Feed back a finished BA: whether it was global, its wall time [s] and the robust chi2 per observation it left
+    void addResult(const bool global, const double time, const double chi2PerObs){
+        const ros::WallTime now = ros::WallTime::now();
+        if (lastStart.toSec()>0){
+            // time since the previous BA was started vs the time this one took
+            const double interval = std::max(time, (now-lastStart).toSec());
+            load = alpha*load + (1.0-alpha)*time/interval;
+        }
+        lastStart = now;
+
+        double& cost = global ? costGlobal : costLocal;
+        cost = cost<=0 ? time : alpha*cost + (1.0-alpha)*time;
+        if (global){
+            kfsSinceGlobal = 0;
+        }
+        baseline = chi2PerObs;
+        errorSum = 0;
+        errorNr = 0;
+        kfsSinceBA = 0;
+        ROS_INFO("BAS = %s BA took [%.1fms] leaving [%g] per observation. Cost [Local: %.1fms Global: %.1fms] Load [%.0f%%]",
+                 global ? "Global" : "Local", time*1000., chi2PerObs, costLocal*1000., costGlobal*1000., load*100.);
+    }
+
+    void reset(){
+        baseline = -1;
+        errorSum = 0;
+        errorNr = 0;
+        kfsSinceBA = 0;
+        kfsSinceGlobal = 0;
+    }
+
+    void printStats() const {
+        ROS_INFO("BAS = BA decisions [None: %u] [Local: %u] [Global: %u]", nrNone, nrLocal, nrGlobal);
+    }
+
+    static const char* getDecisionName(const Decision d){
+        switch (d){
+            case BA_NONE:   return "NONE";
+            case BA_LOCAL:  return "LOCAL";
+            case BA_GLOBAL: return "GLOBAL";
+        }
+        return "UNKNOWN";
+    }
+
+    bool isOn() const {return on;}
+    Decision getDecision() const {return lastDecision;}
+    const char* getReason() const {return lastReason;}
+    double getErrorRatio() const {return lastRatio;}
+    double getLoad() const {return load;}
+    double getCost(const bool global) const {return global ? costGlobal : costLocal;}
+    uint getNoneNr() const {return nrNone;}
+    uint getLocalNr() const {return nrLocal;}
+    uint getGlobalNr() const {return nrGlobal;}
+
+    void setParameter(ollieRosTools::VoNode_paramsConfig &config, uint32_t level){
+        on           = config.ba_schedOn;
+        growthLocal  = config.ba_growthLocal;
+        growthGlobal = config.ba_growthGlobal;
+        globalEvery  = config.ba_globalEvery;
+        maxSkip      = config.ba_maxSkip;
+        maxLoad      = config.ba_maxLoad;
+        budget       = config.g2o_budget/1000.;
+    }
+
+private:
+    Decision decided(const Decision d, const char* reason){
+        lastDecision = d;
+        lastReason = reason;
+        switch (d){
+            case BA_NONE:   ++nrNone;   break;
+            case BA_LOCAL:  ++nrLocal;  break;
+            case BA_GLOBAL: ++nrGlobal; break;
+        }
+        ROS_INFO("BAS = [%s] %s. Error ratio [%.2f] KFs since BA [%d] since global [%d] Load [%.0f%%]",
+                 getDecisionName(d), reason, lastRatio, kfsSinceBA, kfsSinceGlobal, load*100.);
+        return d;
+    }
+
+    /// Settings
+    bool on;
+    double growthLocal;  // error ratio that triggers a local BA
+    double growthGlobal; // error ratio that triggers a global BA
+    int globalEvery;     // keyframes, 0 = only on error growth
+    int maxSkip;         // keyframes without BA before one is forced
+    double maxLoad;      // fraction of wall time BA may use
+    double budget;       // seconds per BA, 0 = unlimited
+    double alpha;        // running average weight of the old estimate
+
+    /// State
+    double baseline;     // chi2 per observation after the last BA, <0 = none yet
+    double errorSum;     // keyframe errors since the last BA
+    int errorNr;
+    int kfsSinceBA;
+    int kfsSinceGlobal;
+    double costLocal;    // running average wall time in seconds
+    double costGlobal;
+    double load;
+    ros::WallTime lastStart;
+
+    /// Statistics
+    double lastRatio;
+    Decision lastDecision;
+    const char* lastReason;
+    uint nrNone;
+    uint nrLocal;
+    uint nrGlobal;
+};
+
+#endif // BASCHEDULER_HPP
@@ -0,0 +1,74 @@
+#ifndef BLURPREDICTOR_HPP
+#define BLURPREDICTOR_HPP
+
+#include <cmath>
+#include <algorithm>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <ros/ros.h>
+#include <ollieRosTools/VoNode_paramsConfig.h>
+#include <ollieRosTools/aux.hpp>
+
+
+
+/// Predicts the motion blur of a frame from the gyro rates alone, so we can drop or downweight frames
+/// before doing any image processing at all. Rotation dominates the blur of a small quadrotor, translation is ignored.
+///  - rotation about the camera x/y axes moves every pixel by ~ f * w * t
+///  - rotation about the optical axis moves pixels by ~ r * w * t, worst at the image corners
+class BlurPredictor {
+public:
+    enum Mode {OFF=0, DROP=1, DOWNWEIGHT=2};
+
+    BlurPredictor():
+        mode(OFF),
+        exposure(0.02),
+        maxBlur(4),
+        blur(-1){}
+
+    /// Predicted blur in pixels given the gyro rates in the IMU frame [rad/s], focal length [px] and image size [px]
+    /// Returns -1 if unknown
+    float predict(const Eigen::Vector3d& gyroImu, const double f, const int width, const int height){
+        if (mode==OFF || f<=0){
+            blur = -1;
+            return blur;
+        }
+        // IMU2CAM is the pose of the camera in the IMU frame
+        const Eigen::Vector3d w = IMU2CAM.linear().transpose() * gyroImu;
+        const double rMax = 0.5*std::sqrt(static_cast<double>(width*width + height*height));
+        blur = exposure * (f*std::sqrt(w[0]*w[0] + w[1]*w[1]) + rMax*std::abs(w[2]));
+        return blur;
+    }
+
+    /// Returns true if the frame should not be processed
+    bool drop() const {
+        return mode==DROP && blur>maxBlur;
+    }
+
+    /// Scales the image quality according to the predicted blur. A quality of -1 (not measured) counts as perfect.
+    float weight(const float quality) const {
+        if (mode!=DOWNWEIGHT || blur<=maxBlur){
+            return quality;
+        }
+        return (quality<0 ? 1.f : quality) * maxBlur/blur;
+    }
+
+    /// Forget the last prediction, eg when there are no IMU rates
+    void clear(){blur = -1;}
+
+    float getBlur() const {return blur;}
+    bool isOn() const {return mode!=OFF;}
+
+    void setParameter(ollieRosTools::VoNode_paramsConfig &config, uint32_t level){
+        mode = static_cast<Mode>(config.blur_mode);
+        exposure = config.blur_exposure;
+        maxBlur = config.blur_maxPx;
+    }
+
+private:
+    Mode mode;
+    float exposure; // seconds
+    float maxBlur;  // pixels
+    float blur;     // last prediction
+};
+
+#endif // BLURPREDICTOR_HPP
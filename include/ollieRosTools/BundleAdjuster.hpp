@@ -0,0 +1,165 @@
+#ifndef BUNDLEADJUSTER_HPP
+#define BUNDLEADJUSTER_HPP
+
+#include <map>
+#include <utility>
+
+#include <Eigen/StdVector>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include <ros/ros.h>
+
+#include <g2o/core/sparse_optimizer.h>
+#include <g2o/core/block_solver.h>
+#include <g2o/core/solver.h>
+#include <g2o/core/robust_kernel_impl.h>
+#include <g2o/core/optimization_algorithm_levenberg.h>
+#include <g2o/core/hyper_graph_action.h>
+#include <g2o/solvers/cholmod/linear_solver_cholmod.h>
+#include <g2o/solvers/dense/linear_solver_dense.h>
+
+#include <ollieRosTools/custom_types/edge_pose_landmark_reprojectBV.hpp>
+#include <ollieRosTools/custom_types/vertex_landmarkxyz.hpp>
+#include <ollieRosTools/custom_types/vertex_pose.hpp>
+
+#include <ollieRosTools/aux.hpp>
+
+
+// Landmark vertex ids are offset by this so they dont collide with keyframe ids
+static const uint MAX_KF = 1000;
+
+
+
+// Everything BA needs, copied out of the map
+struct BAProblem {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    struct KF {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        int kfId;
+        Pose pose;
+        bool fixed;
+    };
+    struct LM {
+        int id;
+        Point3d position;
+    };
+    struct Obs {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        int kfId;
+        int lmId;
+        Eigen::Vector2d measurement; // image plane, depth 1
+    };
+    std::vector<KF, Eigen::aligned_allocator<KF> > kfs;
+    std::vector<LM, Eigen::aligned_allocator<LM> > lms;
+    std::vector<Obs, Eigen::aligned_allocator<Obs> > obs;
+    int maxKfId; // anything newer was added after the snapshot
+    int maxLmId;
+    // settings at the time of the snapshot
+    bool dense;
+    int iter;
+    bool huber;
+    bool schur;    // use SchurBA instead of g2o
+    double budget; // seconds, 0 = no limit
+    double gain;   // stop once the relative chi2 decrease drops below this, 0 = off
+    bool global;   // all keyframes, not just the local window
+    double outlierChi2; // observations with a larger squared image plane error are culled after the optimisation, 0 = off
+    int outlierIter;    // iterations of the re-optimisation without them
+    bool marginals;     // also compute the marginal covariance of the keyframe poses, see SchurBA::marginals
+    bool structure;     // warm start with a structure only refinement of lms
+    bool poseGraph;     // afterwards optimise pgKfs over the pose graph, see OdoMap::solvePoseGraph
+    std::vector<KF, Eigen::aligned_allocator<KF> > pgKfs; // all keyframes of the map, poses replaced by the pose graph result
+    std::vector<std::pair<int, int> > pgPairs;            // covisible keyframes (kfIds) among kfs, edges besides consecutive ones
+    // results
+    double time;
+    int iterations;
+    double chi2;   // robust chi2 after the optimisation
+    Bools outliers; // aligned with obs
+    uint nrOutliers;
+    Eigen::MatrixXd poseCov; // 6x6 blocks of the free keyframes, empty if not computed
+    Ints poseCovInd;         // block of kfs[i] in poseCov, -1 if fixed
+};
+
+
+
+// Stops g2o once the relative chi2 decrease per iteration drops below gainThreshold or the time budget [s] is used up. <=0 disables either
+class BATerminateAction : public g2o::HyperGraphAction {
+public:
+    BATerminateAction(g2o::SparseOptimizer& optimizer, const double gainThreshold, const double budget):
+        gainThreshold(gainThreshold),
+        budget(budget),
+        lastChi(-1),
+        stop(false),
+        reason("max iterations"),
+        t0(ros::WallTime::now()){
+        optimizer.setForceStopFlag(&stop);
+    }
+
+    virtual g2o::HyperGraphAction* operator()(const g2o::HyperGraph* graph, g2o::HyperGraphAction::Parameters* /*parameters*/ = 0){
+        const g2o::SparseOptimizer* optimizer = static_cast<const g2o::SparseOptimizer*>(graph);
+        const double chi = optimizer->activeRobustChi2();
+        if (gainThreshold>0 && lastChi>0 && chi>0){
+            const double gain = (lastChi-chi)/chi;
+            if (gain>=0 && gain<gainThreshold){
+                stop = true;
+                reason = "converged";
+            }
+        }
+        lastChi = chi;
+        if (budget>0 && (ros::WallTime::now()-t0).toSec()>budget){
+            stop = true;
+            reason = "time budget";
+        }
+        return this;
+    }
+
+    const char* getReason() const {return reason;}
+
+private:
+    double gainThreshold;
+    double budget;
+    double lastChi;
+    bool stop;
+    const char* reason;
+    ros::WallTime t0;
+};
+
+
+
+/// Keeps one g2o graph alive over all BA runs. Each solve() only adds and removes the vertices and edges that changed
+/// since the last run and updates the estimates of the rest, so nothing is reallocated in steady state.
+/// If the structure did not change at all the Hessian structure is reused as well (online optimisation).
+/// Not thread safe, but it only ever touches its graph and the problem it is given.
+class BundleAdjuster {
+public:
+    BundleAdjuster();
+    ~BundleAdjuster();
+
+    // Brings the graph in line with p, optimises it and writes the results back into p
+    void solve(BAProblem& p);
+
+    // Drops the whole graph
+    void reset();
+
+private:
+    typedef std::map<int, VertexPose*> PoseMap;
+    typedef std::map<int, VertexLandmarkXYZ*> LandmarkMap;
+    typedef std::pair<int, int> EdgeKey; // kfId, lmId
+    typedef std::map<EdgeKey, EdgePoseLandmarkReprojectBV*> EdgeMap;
+
+    // Creates an empty optimiser with a dense or cholmod linear solver
+    void makeOptimizer(const bool dense);
+
+    g2o::SparseOptimizer* optimizer;
+    bool dense;
+    bool huber;
+    PoseMap poses;
+    LandmarkMap lms;
+    EdgeMap edges;
+
+    // Statistics
+    uint nrSolves;
+    uint nrRebuilds; // solves that had to rebuild the structure
+};
+
+#endif // BUNDLEADJUSTER_HPP
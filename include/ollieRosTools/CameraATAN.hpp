@@ -170,6 +170,14 @@ class CameraATAN {
             return infoMsgPtr;
         }
 
+        // Focal length [px per radian] at the centre of a raw (distorted) image of the given width. Unlike getCamInfo()
+        // this does not depend on the rectified output size or zoom
+        double getRawFocal(const int width) const {
+            // ATAN model r_d = atan(r_u*d2t)/fov, its slope at the centre is d2t/fov
+            const double slope = fov>1e-6 ? 2.0*tan(fov/2.0)/fov : 1.0;
+            return fx*width*slope;
+        }
+
 
 
         // Rotate a point in place
@@ -0,0 +1,179 @@
+#ifndef COVISIBILITYGRAPH_HPP
+#define COVISIBILITYGRAPH_HPP
+
+#include <map>
+#include <set>
+#include <vector>
+#include <algorithm>
+
+#include <ros/ros.h>
+
+#include <ollieRosTools/aux.hpp>
+#include <ollieRosTools/Landmark.hpp>
+#include <ollieRosTools/Frame.hpp>
+
+
+
+/// Keyframe - keyframe graph weighted by the number of landmarks two keyframes share.
+/// Maintained incrementally by the map: a keyframe is added once all its observations are in place, observations removed
+/// later (outlier culling) and removed keyframes are subtracted again. Nothing here scans the whole map.
+class CovisibilityGraph {
+public:
+    typedef std::map<int, uint> Weights; // kfId -> shared landmarks
+
+    // Adds kf with edges to every keyframe observing one of its landmarks
+    void addKF(const Frame::Ptr& kf){
+        const int id = kf->getKfId();
+        ROS_ASSERT(nodes.find(id) == nodes.end());
+        Node& node = nodes[id];
+        node.kf = kf;
+        const Landmark::IntMap& refs = kf->getLandmarkRefs();
+        for (Landmark::IntMap::const_iterator it = refs.begin(); it != refs.end(); ++it){
+            const Landmark::Ptr& lm = it->second;
+            for (uint o=0; o<lm->getObservationsNr(); ++o){
+                const int other = lm->getObservationFrame(o)->getKfId();
+                if (other!=id && nodes.find(other)!=nodes.end()){
+                    ++node.weights[other];
+                    ++nodes[other].weights[id];
+                }
+            }
+        }
+        ROS_INFO("COV = Added KF [%d] with [%lu] covisible keyframes", id, node.weights.size());
+    }
+
+    // Removes kf and all its edges
+    void removeKF(const int kfId){
+        std::map<int, Node>::iterator it = nodes.find(kfId);
+        if (it == nodes.end()){
+            return;
+        }
+        for (Weights::const_iterator w = it->second.weights.begin(); w != it->second.weights.end(); ++w){
+            nodes[w->first].weights.erase(kfId);
+        }
+        nodes.erase(it);
+    }
+
+    // Call before removing the observation of lm by keyframe kfId
+    void removeObservation(const int kfId, const Landmark::Ptr& lm){
+        std::map<int, Node>::iterator it = nodes.find(kfId);
+        if (it == nodes.end()){
+            return;
+        }
+        for (uint o=0; o<lm->getObservationsNr(); ++o){
+            const int other = lm->getObservationFrame(o)->getKfId();
+            if (other==kfId){
+                continue;
+            }
+            std::map<int, Node>::iterator ot = nodes.find(other);
+            if (ot != nodes.end()){
+                decrement(it->second.weights, other);
+                decrement(ot->second.weights, kfId);
+            }
+        }
+    }
+
+    // Call after the observation of lm by keyframe kfId was added to an already inserted keyframe
+    void addObservation(const int kfId, const Landmark::Ptr& lm){
+        std::map<int, Node>::iterator it = nodes.find(kfId);
+        if (it == nodes.end()){
+            return;
+        }
+        for (uint o=0; o<lm->getObservationsNr(); ++o){
+            const int other = lm->getObservationFrame(o)->getKfId();
+            if (other==kfId){
+                continue;
+            }
+            std::map<int, Node>::iterator ot = nodes.find(other);
+            if (ot != nodes.end()){
+                ++it->second.weights[other];
+                ++ot->second.weights[kfId];
+            }
+        }
+    }
+
+    void reset(){
+        nodes.clear();
+    }
+
+    // Number of landmarks kf a and b share
+    uint getWeight(const int a, const int b) const {
+        std::map<int, Node>::const_iterator it = nodes.find(a);
+        if (it == nodes.end()){
+            return 0;
+        }
+        Weights::const_iterator w = it->second.weights.find(b);
+        return w == it->second.weights.end() ? 0 : w->second;
+    }
+
+    // Up to k keyframes sharing at least minWeight landmarks with kf, most shared first. k = 0: all of them
+    Frame::Ptrs getCovisibleKFs(const int kfId, const uint k, const uint minWeight=1) const {
+        Frame::Ptrs kfs;
+        std::map<int, Node>::const_iterator it = nodes.find(kfId);
+        if (it == nodes.end()){
+            return kfs;
+        }
+        std::vector<std::pair<uint, int> > sorted;
+        for (Weights::const_iterator w = it->second.weights.begin(); w != it->second.weights.end(); ++w){
+            if (w->second>=minWeight){
+                sorted.push_back(std::make_pair(w->second, w->first));
+            }
+        }
+        std::sort(sorted.rbegin(), sorted.rend());
+        const uint nr = k>0 ? std::min<uint>(k, sorted.size()) : sorted.size();
+        for (uint i=0; i<nr; ++i){
+            kfs.push_back(nodes.find(sorted[i].second)->second.kf);
+        }
+        return kfs;
+    }
+
+    // Local map of kf: itself, up to k of its most covisible keyframes and all landmarks they observe (each once)
+    void getLocalMap(const int kfId, const uint k, const uint minWeight, Frame::Ptrs& kfs, Landmark::Ptrs& lms) const {
+        kfs.clear();
+        lms.clear();
+        std::map<int, Node>::const_iterator it = nodes.find(kfId);
+        if (it == nodes.end()){
+            return;
+        }
+        kfs = getCovisibleKFs(kfId, k, minWeight);
+        kfs.push_front(it->second.kf);
+        std::set<int> seen;
+        for (uint i=0; i<kfs.size(); ++i){
+            const Landmark::IntMap& refs = kfs[i]->getLandmarkRefs();
+            for (Landmark::IntMap::const_iterator r = refs.begin(); r != refs.end(); ++r){
+                if (seen.insert(r->second->getId()).second){
+                    lms.push_back(r->second);
+                }
+            }
+        }
+    }
+
+    void printStats(const int kfId) const {
+        std::map<int, Node>::const_iterator it = nodes.find(kfId);
+        if (it == nodes.end()){
+            return;
+        }
+        ROS_INFO("COV = Shared landmarks of KF [%d] with [%lu] keyframes:", kfId, it->second.weights.size());
+        ROS_INFO("   KEYFRAME   | OBS NR");
+        for (Weights::const_iterator w = it->second.weights.begin(); w != it->second.weights.end(); ++w){
+            const Frame::Ptr& kf = nodes.find(w->first)->second.kf;
+            ROS_INFO("   [%3d|%4d] | %3u/%3u", kf->getId(), kf->getKfId(), w->second, kf->getLandmarkRefNr());
+        }
+    }
+
+private:
+    struct Node {
+        Frame::Ptr kf;
+        Weights weights;
+    };
+
+    static void decrement(Weights& weights, const int kfId){
+        Weights::iterator w = weights.find(kfId);
+        if (w != weights.end() && --w->second==0){
+            weights.erase(w);
+        }
+    }
+
+    std::map<int, Node> nodes;
+};
+
+#endif // COVISIBILITYGRAPH_HPP
@@ -0,0 +1,274 @@
+#ifndef DEPTHFILTER_HPP
+#define DEPTHFILTER_HPP
+
+#include <map>
+#include <cmath>
+#include <algorithm>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <Eigen/LU>
+
+#include <ros/ros.h>
+#include <ollieRosTools/VoNode_paramsConfig.h>
+#include <ollieRosTools/aux.hpp>
+#include <ollieRosTools/Frame.hpp>
+#include <ollieRosTools/Landmark.hpp>
+
+
+
+/// Inverse depth filters (seeds) for the keypoints of the latest keyframe that have no landmark yet, as in SVO
+/// (Vogiatzis and Hernandez). Every tracked frame that matches a seed triangulates it and refines its inverse depth with
+/// a cheap scalar update: a Gaussian for good measurements mixed with a uniform distribution for outliers, the inlier
+/// ratio kept as a Beta distribution. Seeds that converged become landmarks at the next keyframe, outliers are dropped.
+/// Points without enough parallax for a reliable depth never reach matching or BA.
+class DepthFilter {
+public:
+    DepthFilter():
+        on(false),
+        pxErrorAngle(OVO::px2degrees(1.)*toRad),
+        convergence(0.05),
+        minInlierRatio(0.1),
+        zRange(0),
+        nrUpdates(0),
+        nrDropped(0){
+    }
+
+    /// Starts seeds on all keypoints of kf without a landmark. Their depth range comes from the landmarks kf observes,
+    /// if it has none no seeds are started
+    void reset(FramePtr kf){
+        seeds.clear();
+        this->kf = kf;
+        nrUpdates = 0;
+        nrDropped = 0;
+        if (!on){
+            return;
+        }
+        const Landmark::IntMap& refs = kf->getLandmarkRefs();
+        if (refs.empty()){
+            ROS_WARN("DEP = KF [%d|%d] has no landmarks, no depth range to start seeds with", kf->getId(), kf->getKfId());
+            return;
+        }
+        const Pose toKF = kf->getPose().inverse();
+        Doubles depths;
+        depths.reserve(refs.size());
+        for (Landmark::IntMap::const_iterator it = refs.begin(); it != refs.end(); ++it){
+            depths.push_back((toKF*it->second->getPosition()).norm());
+        }
+        const double minDepth = std::max(1e-3, *std::min_element(depths.begin(), depths.end()));
+        const double meanDepth = OVO::medianApprox<double>(depths);
+        zRange = 1.0/minDepth;
+
+        const Eigen::MatrixXd& bvs = kf->getBearings();
+        for (int i=0; i<bvs.rows(); ++i){
+            if (refs.find(i) != refs.end()){
+                continue;
+            }
+            Seed& s = seeds[i];
+            s.bv = bvs.row(i).transpose().normalized();
+            s.mu = 1.0/meanDepth;
+            s.sigma2 = zRange*zRange/36.;
+            s.a = 10;
+            s.b = 10;
+            s.updates = 0;
+        }
+        ROS_INFO("DEP = Started [%lu] seeds on KF [%d|%d] with median depth [%.2f] and min depth [%.2f]", seeds.size(), kf->getId(), kf->getKfId(), meanDepth, minDepth);
+    }
+
+    void clear(){
+        seeds.clear();
+        kf = FramePtr();
+    }
+
+    /// Keypoint indices of the seeds in the keyframe
+    Ints getSeedKps() const {
+        Ints kps;
+        kps.reserve(seeds.size());
+        for (SeedMap::const_iterator it = seeds.begin(); it != seeds.end(); ++it){
+            kps.push_back(it->first);
+        }
+        return kps;
+    }
+
+    /// Keyframe bearings as seen from f. Seeds are projected at their mean depth, other keypoints only rotated
+    Eigen::MatrixXd predict(FramePtr f){
+        const Pose kfToF = f->getPose().inverse() * kf->getPose();
+        Eigen::MatrixXd bvs = kf->getBearings() * kfToF.linear().transpose();
+        for (SeedMap::const_iterator it = seeds.begin(); it != seeds.end(); ++it){
+            bvs.row(it->first) = (kfToF * (it->second.bv/it->second.mu)).normalized().transpose();
+        }
+        return bvs;
+    }
+
+    /// Updates the seeds matched in f (query: f, train: the keyframe). Seeds that turned out to be outliers are dropped.
+    /// Returns the number of seeds updated
+    uint update(FramePtr f, const DMatches& ms){
+        if (seeds.empty()){
+            return 0;
+        }
+        ros::WallTime t0 = ros::WallTime::now();
+        const Pose fInKF = kf->getPose().inverse() * f->getPose();
+        const Eigen::MatrixXd& bvs = f->getBearings();
+        uint updated = 0, dropped = 0;
+        for (uint i=0; i<ms.size(); ++i){
+            SeedMap::iterator it = seeds.find(ms[i].trainIdx);
+            if (it == seeds.end()){
+                continue;
+            }
+            ++updated;
+            if (!updateSeed(it->second, fInKF, bvs.row(ms[i].queryIdx).transpose().normalized())){
+                seeds.erase(it);
+                ++dropped;
+            }
+        }
+        nrUpdates += updated;
+        nrDropped += dropped;
+        ROS_INFO("DEP = Updated [%u/%lu] seeds from frame [%d|%d], dropped [%u], [%u] converged [%.1fms]",
+                 updated, seeds.size()+dropped, f->getId(), f->getKfId(), dropped, getConvergedNr(), (ros::WallTime::now()-t0).toSec()*1000.);
+        return updated;
+    }
+
+    /// The matches of converged seeds (train: the keyframe) whose point f sees within maxError, and their points in the world frame
+    void getConverged(FramePtr f, const DMatches& ms, const double maxError, DMatches& converged, Points3d& points){
+        converged.clear();
+        points.clear();
+        const Pose toF = f->getPose().inverse();
+        const Eigen::MatrixXd& bvs = f->getBearings();
+        for (uint i=0; i<ms.size(); ++i){
+            SeedMap::const_iterator it = seeds.find(ms[i].trainIdx);
+            if (it == seeds.end() || !isConverged(it->second)){
+                continue;
+            }
+            const Point3d point = kf->getPose() * (it->second.bv/it->second.mu);
+            const Bearing bvF = bvs.row(ms[i].queryIdx).transpose().normalized();
+            if (1.0-bvF.dot((toF*point).normalized()) > maxError){
+                continue;
+            }
+            converged.push_back(ms[i]);
+            points.push_back(point);
+        }
+    }
+
+    uint getConvergedNr() const {
+        uint nr = 0;
+        for (SeedMap::const_iterator it = seeds.begin(); it != seeds.end(); ++it){
+            nr += isConverged(it->second);
+        }
+        return nr;
+    }
+
+    void printStats() const {
+        if (!kf.empty()){
+            ROS_INFO("DEP = KF [%d|%d] seeds: [%lu] alive [%u] converged, [%u] updates, [%u] dropped",
+                     kf->getId(), kf->getKfId(), seeds.size(), getConvergedNr(), nrUpdates, nrDropped);
+        }
+    }
+
+    bool isOn() const {return on;}
+    uint getSeedNr() const {return seeds.size();}
+
+    void setParameter(ollieRosTools::VoNode_paramsConfig &config, uint32_t level){
+        on             = config.vo_seedsOn;
+        pxErrorAngle   = OVO::px2degrees(config.vo_seedPx)*toRad;
+        convergence    = config.vo_seedConvergence;
+        minInlierRatio = config.vo_seedMinInlier;
+        if (!on){
+            seeds.clear();
+        }
+    }
+
+private:
+    struct Seed {
+        Bearing bv;      // unit bearing in the keyframe
+        double mu;       // inverse depth mean
+        double sigma2;   // inverse depth variance
+        double a;        // Beta distribution of the inlier ratio
+        double b;
+        int updates;
+    };
+    typedef std::map<int, Seed> SeedMap; // keyframe keypoint -> seed
+
+    bool isConverged(const Seed& s) const {
+        return s.updates>0 && std::sqrt(s.sigma2) < convergence*s.mu;
+    }
+
+    // Depth along bvKF of the point seen along bvF from fInKF. False if the rays are (close to) parallel or it is behind kf
+    static bool triangulateDepth(const Pose& fInKF, const Bearing& bvKF, const Bearing& bvF, double& depth){
+        Eigen::Matrix<double, 3, 2> A;
+        A.col(0) = bvKF;
+        A.col(1) = -(fInKF.linear()*bvF);
+        const Eigen::Matrix2d AtA = A.transpose()*A;
+        if (AtA.determinant()<1e-6){
+            return false;
+        }
+        const Eigen::Vector2d d = AtA.inverse()*A.transpose()*fInKF.translation();
+        depth = d[0];
+        return depth>0 && d[1]>0;
+    }
+
+    // Depth standard deviation of a point at depth along bvKF caused by pxErrorAngle in the other view
+    double depthSigma(const Pose& fInKF, const Bearing& bvKF, const double depth) const {
+        const Eigen::Vector3d t = fInKF.translation();
+        const Eigen::Vector3d a = bvKF*depth - t;
+        const double tNorm = t.norm();
+        const double alpha = std::acos(std::max(-1., std::min(1., bvKF.dot(t)/tNorm)));
+        const double beta = std::acos(std::max(-1., std::min(1., a.dot(-t)/(tNorm*a.norm()))));
+        const double betaPlus = beta + pxErrorAngle;
+        const double gammaPlus = M_PI - alpha - betaPlus;
+        return tNorm*std::sin(betaPlus)/std::sin(gammaPlus) - depth;
+    }
+
+    // Gaussian x uniform update with the measurement of s seen along bvF from fInKF. False if the seed should be dropped
+    bool updateSeed(Seed& s, const Pose& fInKF, const Bearing& bvF) const {
+        double depth;
+        if (fInKF.translation().norm()<1e-9 || !triangulateDepth(fInKF, s.bv, bvF, depth)){
+            // count it as an outlier
+            s.b += 1;
+            return s.a/(s.a+s.b) >= minInlierRatio;
+        }
+        const double tau = depthSigma(fInKF, s.bv, depth);
+        const double tauInv = 0.5*(1.0/std::max(1e-7, depth-tau) - 1.0/(depth+tau));
+        const double tau2 = tauInv*tauInv;
+        const double x = 1.0/depth;
+
+        const double normScale = std::sqrt(s.sigma2 + tau2);
+        const double likelihood = std::exp(-0.5*(x-s.mu)*(x-s.mu)/(normScale*normScale)) / (std::sqrt(2.*M_PI)*normScale);
+        const double s2 = 1.0/(1.0/s.sigma2 + 1.0/tau2);
+        const double m = s2*(s.mu/s.sigma2 + x/tau2);
+        double C1 = s.a/(s.a+s.b) * likelihood;
+        double C2 = s.b/(s.a+s.b) * 1.0/zRange;
+        const double norm = C1+C2;
+        if (norm<=0){
+            return false;
+        }
+        C1 /= norm;
+        C2 /= norm;
+        const double f = C1*(s.a+1.)/(s.a+s.b+1.) + C2*s.a/(s.a+s.b+1.);
+        const double e = C1*(s.a+1.)*(s.a+2.)/((s.a+s.b+1.)*(s.a+s.b+2.)) + C2*s.a*(s.a+1.)/((s.a+s.b+1.)*(s.a+s.b+2.));
+
+        const double muNew = C1*m + C2*s.mu;
+        s.sigma2 = C1*(s2 + m*m) + C2*(s.sigma2 + s.mu*s.mu) - muNew*muNew;
+        s.mu = muNew;
+        s.a = (e-f)/(f-e/f);
+        s.b = s.a*(1.0-f)/f;
+        ++s.updates;
+        return s.mu>0 && s.sigma2>0 && s.a/(s.a+s.b) >= minInlierRatio;
+    }
+
+    /// Settings
+    bool on;
+    double pxErrorAngle;   // measurement noise in radians
+    double convergence;    // converged once the relative depth sigma (inverse depth sigma / inverse depth) is below this
+    double minInlierRatio; // seeds with a lower expected inlier ratio are dropped
+
+    /// State
+    FramePtr kf;
+    SeedMap seeds;
+    double zRange;         // inverse of the smallest depth seen by the keyframe
+
+    /// Statistics
+    uint nrUpdates;
+    uint nrDropped;
+};
+
+#endif // DEPTHFILTER_HPP
@@ -28,7 +28,6 @@
 class Frame{
 
     protected:
-        cv::Mat image_orig;
         cv::Mat image;
         static cv::Mat mask, maskRect;
         cv::Mat sbi;
@@ -37,8 +36,7 @@ class Frame{
         opengv::rotation_t imuAttitude; // IMU rotation in the world frame
         Eigen::Affine3d pose; // transformation of the camera in the world frame
         double roll, pitch, yaw;  //quad frame
-        /// TODO not used yet
-        double gyroX, gyroY, GyroZ; //quad frame
+        double gyroX, gyroY, gyroZ; // quad frame, rad/s
         double accX, accY, accZ; // quad frame
 
         // Meta
@@ -49,8 +47,7 @@ class Frame{
         int kfId; //keyframe id
         bool initialised;
         double timePreprocess, timeDetect, timeExtract;
-        float quality; // <0 means not measured, 0 means bad, 1 means perfect
-        static float averageQuality;
+        float quality; // <0 means not measured, 0 means bad, 1 means perfect. Estimated on the raw image, see ImageQuality
         bool hasPoseEstimate;
 
         // Type of descriptor / detector used
@@ -107,93 +104,6 @@ class Frame{
             ROS_INFO("FRA < Computed [%lu] Keypoints of [Type: %d] for frame [id: %d] in  [%.1fms] ", keypointsImg.size(), getDetId(), getId(),timeDetect*1000.);
         }
 
-        /// TODO: estiamte image quality. -1 = not estaimted, 0 = bad, 1 = perfect
-        void estimateImageQuality(){
-            ROS_INFO("FRA > Computing Image Quality Frame [%d]", getId());
-            /// USE MASK
-            /// estimate noise
-            /// estiamte drop outs
-            /// estimate blur
-
-            quality =  -1.0;
-
-            // compute average quality
-            const float alpha = 0.9;
-            if (quality>0){
-                averageQuality = averageQuality*alpha + quality*(1.f-alpha);
-            }
-
-
-
-            bool fail = false;
-            {
-                cv::Rect r(0,0,8,image_orig.rows);
-                cv::Mat m = image_orig(r);
-                //cv::rectangle(image_orig, r, 255,3);
-
-
-                double minVal;
-                double maxVal;
-                cv::Point minLoc;
-                cv::Point maxLoc;
-                minMaxLoc( m, &minVal, &maxVal, &minLoc, &maxLoc );
-                //OVO::putInt(image_orig, maxVal, cv::Point(20, 20+30*0), CV_RGB(255,0,0), true, "MAX");
-                //OVO::putInt(image_orig, minVal, cv::Point(20, 20+30*2), CV_RGB(255,0,0), true, "MIN");
-                //OVO::putInt(image_orig, cv::mean(m)[0], cv::Point(20, 20+30*3), CV_RGB(255,0,0), false, "MED");
-
-                if (maxVal>40){
-                    fail = true;
-                }
-
-                //image_orig(r) = 255-image_orig(r);
-            }
-            if (!fail) {
-                cv::Rect r(image_orig.cols-9,0,9,image_orig.rows);
-                cv::Mat m = image_orig(r);
-                //cv::rectangle(image_orig, r, 255,3);
-                double minVal;
-                double maxVal;
-                cv::Point minLoc;
-                cv::Point maxLoc;
-                minMaxLoc( m, &minVal, &maxVal, &minLoc, &maxLoc );
-                //OVO::putInt(image_orig, maxVal, cv::Point(400, 20+30*0), CV_RGB(255,0,0), true, "MAX");
-                //OVO::putInt(image_orig, minVal, cv::Point(400, 20+30*1), CV_RGB(255,0,0), true, "MIN");
-                //OVO::putInt(image_orig, cv::mean(m)[0], cv::Point(400, 20+30*2), CV_RGB(255,0,0), false, "MED");
-                if (maxVal>40){
-                    fail = true;
-                }
-                //image_orig(r) = 255-image_orig(r);
-
-            }
-
-            if (fail){
-                quality =0.01;
-                //cv::imshow("fail", image_orig);
-                //cv::waitKey(10);
-                ROS_WARN("FRA < Computed Image Quality FAIL: %f", quality);
-            } else {
-                quality = 1.0;
-                ROS_INFO("FRA < Computed Image Quality OKAY: %f", quality);
-
-                /*
-                std::vector<int> compression_params;
-                compression_params.push_back(CV_IMWRITE_PNG_COMPRESSION);
-                compression_params.push_back(9);
-                cv::Mat jakob = cv::Mat::zeros(image.size(), image.type());
-                image.copyTo(jakob, getMask());
-                cv::imwrite("./jakob/"+boost::lexical_cast<std::string>(ros::Time::now().toSec())+".png", jakob,compression_params);
-                */
-            }
-
-
-            //ROS_WARN("FRA = NOT IMPLEMENTED IMAGE QUALITY");
-            //ROS_INFO("FRA < Computed Image Quality %f/%f", quality, averageQuality);
-
-        }
-
-
-
-
     public:
         EIGEN_MAKE_ALIGNED_OPERATOR_NEW
         typedef cv::Ptr<Frame> Ptr;
@@ -221,7 +131,7 @@ class Frame{
 
 
 
-        Frame(const cv::Mat& img, const tf::StampedTransform& imu);
+        Frame(const cv::Mat& img, const tf::StampedTransform& imu, const float imgQuality = -1.f);
 
         void static setCamera  (cv::Ptr<CameraATAN> cm){cameraModel=cm;}
         void static setDetector(cv::Ptr<Detector>    d){detector=d;    }
@@ -260,6 +170,17 @@ class Frame{
             }
         }
 
+        // Replaces the keypoints with ones tracked by KLT. These are never redetected, descriptors are only extracted if asked for
+        void setTrackedKeypoints(KeyPoints& kps){
+            swapKeypoints(kps);
+            detectorId = -2;
+        }
+
+        // True if the keypoints came from KLT tracking instead of the detector
+        bool isTracked() const{
+            return detectorId == -2;
+        }
+
 
 
 
@@ -395,6 +316,18 @@ class Frame{
             return image.size();
         }
 
+        // Angular rates and accelerations of the IMU at the time of the frame, in the quad frame
+        void setImuRates(const Eigen::Vector3d& gyro, const Eigen::Vector3d& acc){
+            gyroX = gyro[0]; gyroY = gyro[1]; gyroZ = gyro[2];
+            accX  = acc[0];  accY  = acc[1];  accZ  = acc[2];
+        }
+        Eigen::Vector3d getGyro() const {
+            return Eigen::Vector3d(gyroX, gyroY, gyroZ);
+        }
+        Eigen::Vector3d getAcc() const {
+            return Eigen::Vector3d(accX, accY, accZ);
+        }
+
         // Gets IMU roll
         float getRoll() const{
             return roll;
@@ -588,7 +521,7 @@ class Frame{
             if (!dontCompute){
                 if (keypointsImg.empty()){
                     computeKeypoints();
-                } else if (getDetId() != detector->getDetectorId()){
+                } else if (getDetId() != detector->getDetectorId() && !isTracked()){
                     // we have outdated keypoints - recompute
                     ROS_WARN("FRA > Keypoints outdated [%d != %d], redetecting", getDetId(), detector->getDetectorId());
                     computeKeypoints();
@@ -748,6 +681,11 @@ class Frame{
             return id;
         }
 
+        // time stamp of the image
+        const ros::Time& getTime() const {
+            return time;
+        }
+
         // gets the pose of the camera ( orIMU)
         const geometry_msgs::Pose getPoseMarker(bool imu=false, bool swapxz = false) const {
             geometry_msgs::Pose pm;
@@ -838,8 +776,7 @@ class FrameSynthetic : public Frame {
             timeExtract    = 0;
             timeDetect     = 0;
 
-            /// SHOULD BE SET SOMEHOW
-            gyroX = gyroY = GyroZ = 0.0;
+            gyroX = gyroY = gyroZ = 0.0;
             accX  = accY  = accZ  = 0.0;
 
             detectorId = -1; //-1 = none, -2 = KLT
@@ -868,8 +805,8 @@ class FrameSynthetic : public Frame {
             OVO::tf2RPY(imuAttitude, pitch, roll, yaw);
 //            OVO::tf2RPY(imuAttitude, roll, pitch, yaw);
 
-            /// TODO: estiamte quality of imageu using acceleromter, gyro and blurriness estiamtion
-            estimateImageQuality();
+            // synthetic images are always perfect
+            quality = -1.f;
             hasPoseEstimate = false;
             /*
             IOFormat CleanFmt(4, 0, ", ", "\n", "[", "]");
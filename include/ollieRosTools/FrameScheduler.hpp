@@ -0,0 +1,150 @@
+#ifndef FRAMESCHEDULER_HPP
+#define FRAMESCHEDULER_HPP
+
+#include <algorithm>
+#include <ros/ros.h>
+#include <ollieRosTools/VoNode_paramsConfig.h>
+#include <ollieRosTools/aux.hpp>
+
+
+
+/// Decides per incoming frame how much work we can afford so we stay within a per frame latency budget.
+/// Keeps running averages of what each stage costs and compares them against the age of the frame:
+///  - FULL:       frame + tracking + keyframe/BA work fits into the budget
+///  - TRACK_ONLY: only frame + tracking fits, no keyframes, initialisation or BA for this frame
+///  - SKIP:       not even tracking fits, drop the frame before touching it
+/// Frames the transport dropped (the subscriber queue is 1) are detected from gaps in the header sequence numbers.
+class FrameScheduler {
+public:
+    enum Decision {FULL=0, TRACK_ONLY=1, SKIP=2};
+    enum Stage {ST_FRAME=0, ST_TRACK=1, ST_KF=2, ST_NR=3};
+
+    FrameScheduler():
+        on(false),
+        useAge(true),
+        budget(0.05),
+        alpha(0.9),
+        maxSkip(5),
+        lastSeq(0),
+        haveSeq(false),
+        skipCounter(0),
+        nrFull(0),
+        nrTrackOnly(0),
+        nrSkipped(0),
+        nrDropped(0),
+        lastDecision(FULL),
+        lastAge(0){
+        std::fill(cost, cost+ST_NR, 0.0);
+    }
+
+    /// Call once per incoming frame, before doing any work on it
+    Decision decide(const ros::Time& stamp, const uint seq){
+        // Transport drops
+        if (haveSeq && seq>lastSeq+1){
+            nrDropped += seq-lastSeq-1;
+            ROS_WARN("SCH = Transport dropped [%u] frames [%u total]", seq-lastSeq-1, nrDropped);
+        }
+        lastSeq = seq;
+        haveSeq = true;
+
+        if (!on){
+            lastDecision = FULL;
+            ++nrFull;
+            return lastDecision;
+        }
+
+        // How long the frame has already been waiting
+        lastAge = useAge ? std::max(0.0, (ros::Time::now()-stamp).toSec()) : 0.0;
+
+        const double tTrack = lastAge + cost[ST_FRAME] + cost[ST_TRACK];
+        if (tTrack > budget && skipCounter < maxSkip){
+            // Cannot even track in time
+            lastDecision = SKIP;
+            ++skipCounter;
+            ++nrSkipped;
+        } else if (tTrack + cost[ST_KF] > budget){
+            // Also used when we skipped too many in a row, the estimates might be stale
+            lastDecision = TRACK_ONLY;
+            skipCounter = 0;
+            ++nrTrackOnly;
+        } else {
+            lastDecision = FULL;
+            skipCounter = 0;
+            ++nrFull;
+        }
+
+        ROS_INFO("SCH = [%s] Age [%.1fms] Cost [Frame: %.1fms Track: %.1fms KF: %.1fms] Budget [%.1fms]",
+                 getDecisionName(lastDecision), lastAge*1000., cost[ST_FRAME]*1000., cost[ST_TRACK]*1000., cost[ST_KF]*1000., budget*1000.);
+        return lastDecision;
+    }
+
+    /// Feed back how long a stage took [s]. ST_KF is the extra time a keyframe cost on top of tracking.
+    void addCost(const Stage s, const double time){
+        if (cost[s]<=0){
+            cost[s] = time;
+        } else {
+            cost[s] = alpha*cost[s] + (1.0-alpha)*time;
+        }
+    }
+
+    /// Feed back the time of a whole odometry update and whether it added a keyframe
+    void addUpdateCost(const double time, const bool addedKf){
+        if (addedKf){
+            addCost(ST_KF, std::max(0.0, time-cost[ST_TRACK]));
+        } else {
+            addCost(ST_TRACK, time);
+        }
+    }
+
+    void printStats() const {
+        ROS_INFO("SCH = Frames [Full: %u] [Track Only: %u] [Skipped: %u] [Dropped: %u]", nrFull, nrTrackOnly, nrSkipped, nrDropped);
+    }
+
+    static const char* getDecisionName(const Decision d){
+        switch (d){
+            case FULL:       return "FULL";
+            case TRACK_ONLY: return "TRACK_ONLY";
+            case SKIP:       return "SKIP";
+        }
+        return "UNKNOWN";
+    }
+
+    bool isOn() const {return on;}
+    Decision getDecision() const {return lastDecision;}
+    double getAge() const {return lastAge;}
+    double getCost(const Stage s) const {return cost[s];}
+    uint getSkippedNr() const {return nrSkipped;}
+    uint getTrackOnlyNr() const {return nrTrackOnly;}
+    uint getDroppedNr() const {return nrDropped;}
+
+    void setParameter(ollieRosTools::VoNode_paramsConfig &config, uint32_t level){
+        on      = config.sched_on;
+        useAge  = config.sched_useAge;
+        budget  = config.sched_budget/1000.;
+        alpha   = config.sched_alpha;
+        maxSkip = config.sched_maxSkip;
+    }
+
+private:
+    bool on;
+    bool useAge;    // include the time the frame spent in transport. Needs synchronised clocks
+    double budget;  // seconds
+    double alpha;   // running average weight of the old estimate
+    int maxSkip;    // never skip more than this many frames in a row
+
+    double cost[ST_NR]; // running average cost per stage in seconds
+
+    uint lastSeq;
+    bool haveSeq;
+    int skipCounter;
+
+    // Statistics
+    uint nrFull;
+    uint nrTrackOnly;
+    uint nrSkipped;
+    uint nrDropped;
+    Decision lastDecision;
+    double lastAge;
+};
+
+#endif // FRAMESCHEDULER_HPP
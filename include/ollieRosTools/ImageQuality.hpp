@@ -0,0 +1,63 @@
+#ifndef IMAGEQUALITY_HPP
+#define IMAGEQUALITY_HPP
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <ros/ros.h>
+#include <ollieRosTools/VoNode_paramsConfig.h>
+
+
+
+/// Cheap image quality estimate of the raw (unprocessed, unrectified) image so bad frames can be rejected
+/// before we spend time on preprocessing, rectification, detection and extraction.
+/// -1 = not estimated, 0 = bad, 1 = perfect
+/// The score combines:
+///  - Dropout test: the analog link replaces lines with black/white when the signal drops. The left and right
+///    border columns should be black, if they are not we have a dropout -> 0.01
+///  - Blur: variance of the laplacian on a downsampled, masked image relative to its running average
+///  - Noise: Immerkaer's fast noise variance estimation on the same downsampled image
+/// Everything is done on a small image with vectorised opencv functions, so this costs well under a ms.
+class ImageQuality {
+public:
+    ImageQuality();
+
+    void setParameter(ollieRosTools::VoNode_paramsConfig &config, uint32_t level);
+
+    // Uses the same convention as Frame::setMask, ie white = invalid
+    void setMask(const cv::Mat& maskIn);
+
+    // Estimate the quality of the raw image. Updates the running averages
+    float estimate(const cv::Mat& img);
+
+    // Frames with a quality above this should be processed
+    bool isGood(const float quality) const {
+        return quality > qualityThresh || quality < 0;
+    }
+
+    bool isOn() const {return on;}
+    float getSharpness() const {return sharpness;}
+    float getSharpnessAvg() const {return sharpnessAvg;}
+    float getNoise() const {return noise;}
+    double getTime() const {return time;}
+
+private:
+    bool dropout(const cv::Mat& img) const;
+
+    // Settings
+    bool on;
+    float scale;        // downsample factor, eg 0.25
+    float blurRatio;    // sharpness relative to the running average that is still considered perfect
+    float noiseMax;     // noise sigma [grey values] that is still considered perfect
+    float qualityThresh;
+    double dropoutThresh;
+
+    // Members
+    cv::Mat mask, maskSmall;
+    cv::Mat noiseKernel;
+    float sharpness;
+    float sharpnessAvg; // <0 = not initialised
+    float noise;
+    double time;
+};
+
+#endif // IMAGEQUALITY_HPP
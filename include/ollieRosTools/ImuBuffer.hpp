@@ -0,0 +1,164 @@
+#ifndef IMUBUFFER_HPP
+#define IMUBUFFER_HPP
+
+#include <cmath>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <sensor_msgs/Imu.h>
+
+
+
+/// One IMU measurement. Orientation is the attitude of the IMU in the world frame (x,y,z,w)
+struct ImuSample {
+    double t;
+    double q[4];
+    double w[3];
+    double a[3];
+
+    Eigen::Quaterniond getQuaternion() const {
+        return Eigen::Quaterniond(q[3], q[0], q[1], q[2]);
+    }
+    Eigen::Vector3d getGyro() const {
+        return Eigen::Vector3d(w[0], w[1], w[2]);
+    }
+    Eigen::Vector3d getAcc() const {
+        return Eigen::Vector3d(a[0], a[1], a[2]);
+    }
+};
+
+
+
+/// Lock free single producer / multiple consumer ring buffer of IMU samples.
+/// The IMU callback pushes, the image callback(s) look up interpolated samples. Nobody ever waits on anybody:
+/// every slot is protected by a sequence counter (seqlock), a reader simply retries if the slot was being written
+/// and gives up if it has been overwritten in the meantime. Lookups are bounded by the buffer size.
+class ImuBuffer {
+public:
+    enum Result {
+        FAIL = 0,         // no data for the requested time
+        INTERPOLATED = 1, // requested time between two samples, SLERPed
+        HELD = 2          // IMU is late, returned the newest sample (within the allowed latency)
+    };
+
+    ImuBuffer() : head(0) {
+        for (uint i=0; i<SIZE; ++i){
+            slots[i].seq = 0;
+            slots[i].idx = ~0u;
+        }
+    }
+
+    /// Single producer only
+    void push(const ImuSample& s){
+        const uint h = head;
+        Slot& slot = slots[h & MASK];
+        slot.seq = slot.seq + 1; // odd = being written
+        __sync_synchronize();
+        slot.idx = h;
+        slot.s = s;
+        __sync_synchronize();
+        slot.seq = slot.seq + 1;
+        __sync_synchronize();
+        head = h + 1;
+    }
+
+    void push(const sensor_msgs::Imu& msg){
+        ImuSample s;
+        s.t = msg.header.stamp.toSec();
+        s.q[0] = msg.orientation.x; s.q[1] = msg.orientation.y; s.q[2] = msg.orientation.z; s.q[3] = msg.orientation.w;
+        s.w[0] = msg.angular_velocity.x; s.w[1] = msg.angular_velocity.y; s.w[2] = msg.angular_velocity.z;
+        s.a[0] = msg.linear_acceleration.x; s.a[1] = msg.linear_acceleration.y; s.a[2] = msg.linear_acceleration.z;
+        push(s);
+    }
+
+    /// Get the sample at time t. Orientation is SLERPed, rates linearly interpolated.
+    /// If t is newer than the newest sample by no more than maxLate seconds the newest sample is returned.
+    Result get(const double t, const double maxLate, ImuSample& out) const {
+        const uint h = head;
+        __sync_synchronize();
+        if (h==0){
+            return FAIL;
+        }
+        // Leave one slot margin, the producer might be writing the oldest one
+        const uint oldest = h > SIZE-1 ? h-(SIZE-1) : 0;
+
+        ImuSample newer;
+        if (!read(h-1, newer)){
+            return FAIL;
+        }
+        if (t >= newer.t){
+            if (t-newer.t <= maxLate){
+                out = newer;
+                return HELD;
+            }
+            return FAIL;
+        }
+
+        // Walk back until we find the first sample older than t
+        for (uint i=h-1; i-- > oldest; ){
+            ImuSample older;
+            if (!read(i, older)){
+                return FAIL;
+            }
+            if (older.t <= t){
+                const double dt = newer.t-older.t;
+                const double alpha = dt>0 ? (t-older.t)/dt : 0.0;
+                interpolate(older, newer, alpha, out);
+                out.t = t;
+                return INTERPOLATED;
+            }
+            newer = older;
+        }
+        return FAIL;
+    }
+
+    void clear(){
+        // Only called from the producer thread or when nobody is pushing (eg time jumps in bag files)
+        head = 0;
+        __sync_synchronize();
+    }
+
+private:
+    static const uint SIZE = 512; // ~5 seconds at 100hz, must be a power of two
+    static const uint MASK = SIZE-1;
+
+    struct Slot {
+        volatile uint seq;
+        volatile uint idx;
+        ImuSample s;
+    };
+
+    Slot slots[SIZE];
+    volatile uint head; // number of samples pushed so far
+
+    /// Consistent copy of sample i. False if it is being overwritten or already has been
+    bool read(const uint i, ImuSample& out) const {
+        const Slot& slot = slots[i & MASK];
+        for (int tries=0; tries<8; ++tries){
+            const uint s0 = slot.seq;
+            __sync_synchronize();
+            if (s0 & 1){
+                continue; // being written
+            }
+            if (slot.idx != i){
+                return false; // overwritten by a newer sample
+            }
+            out = slot.s;
+            __sync_synchronize();
+            if (slot.seq == s0){
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void interpolate(const ImuSample& a, const ImuSample& b, const double alpha, ImuSample& out){
+        const Eigen::Quaterniond q = a.getQuaternion().slerp(alpha, b.getQuaternion());
+        out.q[0] = q.x(); out.q[1] = q.y(); out.q[2] = q.z(); out.q[3] = q.w();
+        for (uint i=0; i<3; ++i){
+            out.w[i] = (1.0-alpha)*a.w[i] + alpha*b.w[i];
+            out.a[i] = (1.0-alpha)*a.a[i] + alpha*b.a[i];
+        }
+    }
+};
+
+#endif // IMUBUFFER_HPP
@@ -126,6 +126,13 @@ public:
         return seenFrom[j];
     }
 
+    // get the keypoint id of observation i in its frame
+    int getObservationPointId(const int i=-1) const {
+        const int j = i<0 ? currentObs:i;
+        ROS_ASSERT(j>=0 && j < static_cast<int>(pointIds.size()));
+        return pointIds[j];
+    }
+
     // Returns all frames that saw this point
     const FramePtrs& getObservationIds() const {
         return seenFrom;
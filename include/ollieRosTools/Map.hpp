@@ -5,6 +5,7 @@
 
 #include <deque>
 #include <map>
+#include <set>
 #include <stdio.h>
 
 
@@ -13,19 +14,8 @@
 #include <Eigen/Geometry>
 
 #include <ros/package.h>
+#include <boost/thread.hpp>
 
-#include <g2o/core/sparse_optimizer.h>
-#include <g2o/core/block_solver.h>
-#include <g2o/core/solver.h>
-#include <g2o/core/robust_kernel_impl.h>
-#include <g2o/core/optimization_algorithm_levenberg.h>
-#include <g2o/solvers/cholmod/linear_solver_cholmod.h>
-#include <g2o/solvers/dense/linear_solver_dense.h>
-#include <g2o/solvers/structure_only/structure_only_solver.h>
-
-#include <ollieRosTools/custom_types/edge_pose_landmark_reprojectBV.hpp>
-#include <ollieRosTools/custom_types/vertex_landmarkxyz.hpp>
-#include <ollieRosTools/custom_types/vertex_pose.hpp>
 #include <ollieRosTools/custom_types/register_types.hpp>
 
 
@@ -33,10 +23,16 @@
 #include <ollieRosTools/aux.hpp>
 #include <ollieRosTools/Landmark.hpp>
 #include <ollieRosTools/Matcher.hpp>
+#include <ollieRosTools/BundleAdjuster.hpp>
+#include <ollieRosTools/SchurBA.hpp>
+#include <ollieRosTools/StructureRefiner.hpp>
+#include <ollieRosTools/BAScheduler.hpp>
+#include <ollieRosTools/CovisibilityGraph.hpp>
+#include <ollieRosTools/PoseGraph.hpp>
+
 
 
 
-static const uint MAX_KF = 1000;
 
 // worldPoint[i] corresponds to feature[idx[i]]
 cv::Mat getPointsProjectedImage(const Frame::Ptr f, const opengv::points_t& worldPts, const Ints& idx);
@@ -54,6 +50,10 @@ class OdoMap {
         FramePtr currentFrame;
         // Matcher used to do map-frame and frame-frame matching
         Matcher matcher;
+        // Keyframes weighted by shared landmarks
+        CovisibilityGraph covis;
+        // Relative pose constraints between keyframes measured by BA
+        PoseGraph poseGraph;
 
         /// Meta
         // which frames to fix during BA
@@ -67,21 +67,157 @@ class OdoMap {
 
         /// Settings
         uint maxKFNr;
+        bool kfCull;        // remove the most redundant keyframe instead of the oldest
+        uint kfCullObs;     // a landmark is redundant if this many other keyframes observe it
+        double kfCullRatio; // keyframes with more redundant landmarks are culled even below maxKFNr
+        uint localKFs;      // match against the local map of the newest keyframe with this many covisible keyframes, 0 = whole map
+        uint covisMin;      // shared landmarks for two keyframes to count as covisible
+        bool baCovis;       // local BA window from the covisibility graph instead of the newest keyframes
+        uint fuseKFs;       // fuse new keyframes with the landmarks of this many covisible keyframes, 0 = off
+        double fuseBV;      // bearing error of a fused observation
+        double fuseDepth;   // relative depth difference of two landmarks to count as the same point
         bool g2oDense;
         int g2oIter;
         bool g2oHuber;
-        bool g2oStructure;
+        bool g2oStructure;  // warm start BA with a structure only refinement of its landmarks, done by the BA worker
+        bool refineNew;     // structure only refinement of the landmarks of a new KF if no BA runs for it
+        bool g2oSchur;   // use SchurBA instead of g2o
         FixMethod g2oFix;
+        bool asyncBA;
+        uint baWindow;   // local BA over the newest baWindow keyframes, 0 = all
+        double baBudget; // seconds
+        double baGain;
+        double baOutlierChi2; // squared image plane error, 0 = no culling
+        int baOutlierIter;
+        bool baGlobal;   // next BA covers all keyframes, set by the scheduler
+        bool pgOn;       // keep the keyframes outside the BA consistent with a pose graph instead of global BA
+
+        /// Background BA
+        // The worker only ever touches baProblem and the pose graph edges, so the map can be used while it runs. Results are applied by collectBA()
+        boost::thread baThread;
+        boost::mutex baMutex;
+        bool baDone;     // set by the worker, guarded by baMutex
+        bool baRunning;  // tracking thread only
+        bool baPending;  // another BA was requested while one was running
+        BAProblem baProblem;
+        BundleAdjuster adjuster; // keeps its g2o graph between runs, only used by whoever owns baProblem
+        SchurBA schurBA;
+        StructureRefiner refiner;   // tracking thread
+        StructureRefiner baRefiner; // whoever owns baProblem
+        BAScheduler baScheduler;
+        struct PGRemoval {
+            int kfId;
+            int prevId;
+            int nextId;
+        };
+        std::vector<PGRemoval> pgRemovals; // keyframes removed while the worker used the pose graph
+        ollieRosTools::VoNode_paramsConfig baConfig; // settings of the worker owned objects, applied once the worker is done
+        uint32_t baConfigLevel;
+        bool baConfigPending;
+
+        // Runs the configured solver on baProblem
+        void solveBA(){
+            if (baProblem.structure){
+                baRefiner.refine(baProblem);
+            }
+            if (baProblem.schur){
+                schurBA.solve(baProblem);
+            } else {
+                adjuster.solve(baProblem);
+            }
+            if (baProblem.marginals && !schurBA.marginals(baProblem)){
+                ROS_WARN("MAP = Could not compute the BA marginals, pose graph edges get unit information");
+            }
+            if (baProblem.poseGraph){
+                solvePoseGraph(baProblem);
+            }
+        }
+
+        // Removes a keyframe from the pose graph, or queues that until the worker is done with it
+        void removeFromPoseGraph(const int kfId, const int prevId=-1, const int nextId=-1){
+            if (baRunning){
+                PGRemoval r;
+                r.kfId = kfId;
+                r.prevId = prevId;
+                r.nextId = nextId;
+                pgRemovals.push_back(r);
+            } else {
+                poseGraph.removeKF(kfId, prevId, nextId);
+            }
+        }
+
+        // Call once the worker is done
+        void flushPoseGraphRemovals(){
+            for (uint i=0; i<pgRemovals.size(); ++i){
+                poseGraph.removeKF(pgRemovals[i].kfId, pgRemovals[i].prevId, pgRemovals[i].nextId);
+            }
+            pgRemovals.clear();
+        }
+
+        // Settings of the refiner and pose graph the worker uses and of the scheduler its results feed. Kept pending while it runs
+        void setBAParameter(ollieRosTools::VoNode_paramsConfig &config, uint32_t level){
+            if (baRunning){
+                baConfig = config;
+                baConfigLevel = level;
+                baConfigPending = true;
+                return;
+            }
+            baRefiner.setParameter(config, level);
+            baScheduler.setParameter(config, level);
+            poseGraph.setParameter(config, level);
+        }
+
+        // Call once the worker is done
+        void flushBAParameter(){
+            if (baConfigPending){
+                baConfigPending = false;
+                setBAParameter(baConfig, baConfigLevel);
+            }
+        }
+
+        void baWorker(){
+            solveBA();
+            boost::mutex::scoped_lock lock(baMutex);
+            baDone = true;
+        }
 
 
     public:
         OdoMap(){
             maxKFNr = 10;
+            kfCull = true;
+            kfCullObs = 3;
+            kfCullRatio = 1;
+            localKFs = 0;
+            covisMin = 15;
+            baCovis = false;
+            fuseKFs = 0;
+            fuseBV = OVO::px2error(4);
+            fuseDepth = 0.2;
             g2oDense = false;
             g2oIter = 1000;
             g2oHuber = false;
             g2oStructure = false;
+            refineNew = false;
+            g2oSchur = false;
             g2oFix = FIX_FIRST;
+            asyncBA = true;
+            baWindow = 0;
+            baBudget = 0;
+            baGain = 0;
+            baOutlierChi2 = 0;
+            baOutlierIter = 5;
+            baGlobal = false;
+            pgOn = false;
+            baDone = false;
+            baRunning = false;
+            baPending = false;
+            baConfigLevel = 0;
+            baConfigPending = false;
+        }
+
+        ~OdoMap(){
+            discardBA();
         }
 
         /// /////////////////////////////////////////////////////////////////////////////////
@@ -136,6 +272,15 @@ class OdoMap {
             return landmarks.size();
         }
 
+        // BA decisions and costs
+        const BAScheduler& getBAScheduler() const{
+            return baScheduler;
+        }
+
+        const CovisibilityGraph& getCovisibility() const{
+            return covis;
+        }
+
         // Gets all the descriptors most likely to be observable from the given frame
         uint getAllPossibleObservations(const Frame::Ptr f, cv::Mat& desc, Landmark::Ptrs& lms){
             ROS_INFO("MAP > Getting all possible observations of [%lu] landmarks from frame [%d|%d]", landmarks.size(), f->getId(), f->getKfId());
@@ -144,9 +289,18 @@ class OdoMap {
 
             lms.clear();
 
+            // candidates: the local map around the newest keyframe or all landmarks
+            Landmark::Ptrs localLms;
+            if (localKFs>0 && !keyframes.empty()){
+                Frame::Ptrs localKfs;
+                covis.getLocalMap(keyframes.back()->getKfId(), localKFs, covisMin, localKfs, localLms);
+                ROS_INFO("MAP = Local map of KF [%d]: [%lu] keyframes with [%lu/%lu] landmarks", keyframes.back()->getKfId(), localKfs.size(), localLms.size(), landmarks.size());
+            }
+            const Landmark::Ptrs& candidates = localKFs>0 ? localLms : landmarks;
+
             // add points that are visible. Also sets within the LM from which frame it was visible
-            for (uint i=0; i<landmarks.size(); ++i){
-                Landmark::Ptr lm = landmarks[i];
+            for (uint i=0; i<candidates.size(); ++i){
+                Landmark::Ptr lm = candidates[i];
                 if (lm->visibleFrom(f)){
                     lms.push_back(lm);
                     desc.push_back(lm->getObservationDesc());
@@ -221,6 +375,35 @@ class OdoMap {
         }
 
 
+        // Same as match2KF(f, matches, time, true) but gates with the landmarks projected into the predicted pose of f
+        double match2KFPredicted(Frame::Ptr f, const Pose& fPose, DMatches& matches, double& time){
+            ROS_ASSERT(keyframes.size()>0);
+            FramePtr kf = getLatestKF();
+            currentFrame = f;
+            ROS_INFO("MAP = Matching Frame [%d|%d] against KeyFrame [%d|%d] using a predicted pose", f->getId(), f->getKfId(), kf->getId(), kf->getKfId() );
+            return matcher.matchFramePredicted(f, kf, fPose, matches, time, kf->getIndLM());
+        }
+
+
+        // Tracks the points of fPrev matched against the latest KF (prevMatches) into f with KLT. Same output as match2KF(f, matches, time, true)
+        double track2KF(Frame::Ptr f, Frame::Ptr fPrev, const DMatches& prevMatches, DMatches& matches, double& time){
+            ROS_ASSERT(keyframes.size()>0);
+            FramePtr kf = getLatestKF();
+            currentFrame = f;
+            ROS_INFO("MAP = Tracking Frame [%d|%d] against KeyFrame [%d|%d] via Frame [%d|%d]", f->getId(), f->getKfId(), kf->getId(), kf->getKfId(), fPrev->getId(), fPrev->getKfId());
+            return matcher.trackFrame(f, fPrev, kf, prevMatches, matches, time);
+        }
+
+
+        // Matches f against the keypoints kfMask of the latest KF given their bearings predicted in f, see DepthFilter
+        double match2KFBearings(Frame::Ptr f, const Eigen::MatrixXd& kfBVPred, const Ints& kfMask, DMatches& matches, double& time){
+            ROS_ASSERT(keyframes.size()>0);
+            FramePtr kf = getLatestKF();
+            ROS_INFO("MAP = Matching Frame [%d|%d] against [%lu] predicted points of KeyFrame [%d|%d]", f->getId(), f->getKfId(), kfMask.size(), kf->getId(), kf->getKfId() );
+            return matcher.matchFrameBearings(f, kf, kfBVPred, matches, time, kfMask);
+        }
+
+
         // Matches keyframe vs keyframe for triangulation. Does not match kps taht have already been matches. Returns disparity
         /// TODO: for now very naiive
         double matchTriangulate(Frame::Ptr f1, Frame::Ptr f2, DMatches& matches, double& time){
@@ -244,31 +427,100 @@ class OdoMap {
                 reset();
                 currentFrame = frame;
                 keyframes.push_back(frame);
+                covis.addKF(frame);
                 ROS_INFO("MAP < INITIAL KF PUSHED");
             } else {
+                ros::WallTime t0 = ros::WallTime::now();
                 keyframes.push_back(frame);
+                covis.addKF(frame);
                 currentFrame = frame;
                 ROS_INFO("MAP < KF PUSHED [KFS = %lu]", getKeyframeNr());
+                ros::WallTime tPush = ros::WallTime::now();
+
+                // merge duplicate landmarks before they get optimised separately
+                if (fuseKFs>0){
+                    fuseLandmarks(frame);
+                }
+                ros::WallTime tFuse = ros::WallTime::now();
 
-                // optimise
-                bundleAdjust();
+                // optimise. With asyncBA only the snapshot is taken here
+                if (!bundleAdjust() && refineNew){
+                    refineKF(frame);
+                }
+                ros::WallTime tOpt = ros::WallTime::now();
 
                 // Check we dont have too many keyframes
                 shirnkKFs();
+                ros::WallTime tShrink = ros::WallTime::now();
+                ROS_INFO("MAP = KF [%d] cost on the tracking thread [Push: %.1fms] [Fuse: %.1fms] [BA/Refine: %.1fms] [Shrink: %.1fms] [Total: %.1fms]",
+                         frame->getKfId(), (tPush-t0).toSec()*1000., (tFuse-tPush).toSec()*1000., (tOpt-tFuse).toSec()*1000.,
+                         (tShrink-tOpt).toSec()*1000., (tShrink-t0).toSec()*1000.);
             }
         }
 
-        // Removes KFs if needed
+        // Removes KFs if needed. With culling the most redundant ones go first, else the oldest.
+        // Culling also removes one keyframe that is redundant beyond kfCullRatio, eg taken while hovering
         void shirnkKFs(){
             if (keyframes.size()>maxKFNr || keyframes.size()==MAX_KF) {
-                ROS_INFO("MAP > TOO MANY KEYFRAMES, REMOVING OLDEST");
+                ROS_INFO("MAP > TOO MANY KEYFRAMES, REMOVING %s", kfCull ? "MOST REDUNDANT" : "OLDEST");
                 while(keyframes.size()>maxKFNr){
-                    popKF();
+                    if (!kfCull || !cullKF(0)){
+                        popKF();
+                    }
                 }
                 ROS_INFO("MAP < CAPPED KFS");
+            } else if (kfCull && kfCullRatio<1){
+                cullKF(kfCullRatio);
             }
         }
 
+        // Fraction of the landmarks seen by keyframe i that at least kfCullObs other keyframes observe too
+        double getKFRedundancy(const uint i) const{
+            const Landmark::IntMap& refs = keyframes[i]->getLandmarkRefs();
+            if (refs.empty()){
+                return 1;
+            }
+            uint redundant = 0;
+            for (Landmark::IntMap::const_iterator it = refs.begin(); it != refs.end(); ++it){
+                if (it->second->getObservationsNr() > kfCullObs){
+                    ++redundant;
+                }
+            }
+            return static_cast<double>(redundant)/refs.size();
+        }
+
+        // Removes the most redundant keyframe if its redundancy is at least minRatio. Ties go to the oldest.
+        // The newest keyframe is kept, new landmarks are triangulated against it. Returns true if one was removed
+        bool cullKF(const double minRatio){
+            if (keyframes.size()<3){
+                return false;
+            }
+            ros::WallTime t0 = ros::WallTime::now();
+            uint worst = 0;
+            double worstRatio = -1;
+            for (uint i=0; i<keyframes.size()-1; ++i){
+                const double ratio = getKFRedundancy(i);
+                if (ratio>worstRatio){
+                    worst = i;
+                    worstRatio = ratio;
+                }
+            }
+            if (worstRatio<minRatio){
+                return false;
+            }
+
+            Frame::Ptr kf = keyframes[worst];
+            ROS_INFO(OVO::colorise("MAP > CULLING KF [%d|%d] [%u/%lu] with [%.0f%%] of its [%u] landmarks seen by [%u+] other KFs",OVO::FG_CYAN).c_str(),
+                     kf->getId(), kf->getKfId(), worst, keyframes.size(), worstRatio*100., kf->getLandmarkRefNr(), kfCullObs);
+            covis.removeKF(kf->getKfId());
+            removeFromPoseGraph(kf->getKfId(), worst>0 ? keyframes[worst-1]->getKfId() : -1, keyframes[worst+1]->getKfId());
+            kf->prepareRemoval();
+            keyframes.erase(keyframes.begin()+worst);
+            removeNonVisiblePoints();
+            ROS_INFO("MAP < KF CULLED [%.1fms]", (ros::WallTime::now()-t0).toSec()*1000.);
+            return true;
+        }
+
         // Removes oldest keyframe
         void popKF(){
             Frame::Ptr kf_front = keyframes.front();
@@ -276,6 +528,8 @@ class OdoMap {
 
             ROS_INFO("KF Ref Count befure: [%d]" ,*kf_front.refcount);
 
+            covis.removeKF(kf_front->getKfId());
+            removeFromPoseGraph(kf_front->getKfId());
             kf_front->prepareRemoval();
             removeNonVisiblePoints();
 
@@ -309,6 +563,12 @@ class OdoMap {
         // Resets the map
         void reset(){
             ROS_INFO("MAP > RESETING MAP. Clearing [%lu] key frames and [%lu] land marks", keyframes.size(), landmarks.size());
+            discardBA();
+            adjuster.reset(); // ids start from zero again
+            baScheduler.reset();
+            covis.reset();
+            pgRemovals.clear();
+            poseGraph.reset();
             keyframes.clear();
             landmarks.clear();
             Landmark::reset();
@@ -363,164 +623,594 @@ class OdoMap {
 
 
 
-        // DO bundle adjustment over all points and observations
-        void bundleAdjust(){
-            ROS_INFO("MAP > Doing G2O Bundle adjustment with [%lu] KeyFrames and [%lu] LandMarks", keyframes.size(), landmarks.size());
-            ROS_INFO_STREAM(*this);
-            ros::WallTime tStart = ros::WallTime::now();
+        // True if f has an observation of lm
+        static bool observes(const Landmark::Ptr& lm, const Frame::Ptr& f){
+            const FramePtrs& frames = lm->getObservationIds();
+            for (uint i=0; i<frames.size(); ++i){
+                if (frames[i]->getId()==f->getId()){
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Moves all observations of drop to keep. Frames that observe both only keep their observation of keep.
+        // drop is left without observations, removeNonVisiblePoints() removes it from the map
+        void mergeLandmarks(const Landmark::Ptr& keep, const Landmark::Ptr& drop){
+            // copies, removing observations changes them
+            const FramePtrs frames = drop->getObservationIds();
+            Ints pointIds;
+            for (uint i=0; i<frames.size(); ++i){
+                pointIds.push_back(drop->getObservationPointId(i));
+            }
+            for (uint i=0; i<frames.size(); ++i){
+                const FramePtr& f = frames[i];
+                covis.removeObservation(f->getKfId(), drop);
+                f->removeLandMarkRef(pointIds[i]);
+                if (!observes(keep, f)){
+                    f->addLandMarkRef(pointIds[i], keep);
+                    keep->addObservation(f, pointIds[i]);
+                    covis.addObservation(f->getKfId(), keep);
+                }
+            }
+        }
+
+        // Projects the landmarks of the local map of f that f does not observe yet into f and matches them against its keypoints.
+        // A match on a free keypoint adds the observation to the landmark. A match on a keypoint that already has a landmark at a
+        // similar depth means both are the same point, typically triangulated twice: they are merged into the one with more observations
+        void fuseLandmarks(const Frame::Ptr& f){
+            ros::WallTime t0 = ros::WallTime::now();
+            Frame::Ptrs localKfs;
+            Landmark::Ptrs localLms;
+            covis.getLocalMap(f->getKfId(), fuseKFs, covisMin, localKfs, localLms);
+
+            // candidates f does not see yet but might. Sets their current observation for the descriptor
+            std::set<int> seen;
+            const Landmark::IntMap& refs = f->getLandmarkRefs();
+            for (Landmark::IntMap::const_iterator it = refs.begin(); it != refs.end(); ++it){
+                seen.insert(it->second->getId());
+            }
+            Landmark::Ptrs candidates;
+            cv::Mat descs;
+            for (uint i=0; i<localLms.size(); ++i){
+                if (seen.find(localLms[i]->getId())==seen.end() && localLms[i]->visibleFrom(f)){
+                    candidates.push_back(localLms[i]);
+                    descs.push_back(localLms[i]->getObservationDesc());
+                }
+            }
+            if (candidates.empty()){
+                return;
+            }
+
+            DMatches ms;
+            double time;
+            matcher.matchMap(descs, candidates, f, ms, time);
+
+            const Pose poseInv = f->getPose().inverse();
+            uint added = 0, merged = 0, rejected = 0;
+            for (uint i=0; i<ms.size(); ++i){
+                const int idx = ms[i].queryIdx;
+                const Landmark::Ptr lm = candidates[ms[i].trainIdx];
+                // merged away or already fused at another keypoint
+                if (lm->getObservationsNr()==0 || observes(lm, f)){
+                    continue;
+                }
+                const Point3d P = poseInv * lm->getPosition();
+                if (1.0 - f->getBearing(idx).dot(P.normalized()) > fuseBV){
+                    ++rejected;
+                    continue;
+                }
+
+                Landmark::IntMap::const_iterator it = f->getLandmarkRefs().find(idx);
+                if (it == f->getLandmarkRefs().end()){
+                    f->addLandMarkRef(idx, lm);
+                    lm->addObservation(f, idx);
+                    covis.addObservation(f->getKfId(), lm);
+                    ++added;
+                } else {
+                    const Landmark::Ptr other = it->second;
+                    const double depth = P.norm();
+                    const double depthOther = (poseInv * other->getPosition()).norm();
+                    if (std::abs(depth-depthOther) > fuseDepth*std::min(depth, depthOther)){
+                        ++rejected;
+                        continue;
+                    }
+                    if (other->getObservationsNr() > lm->getObservationsNr()){
+                        mergeLandmarks(other, lm);
+                    } else {
+                        mergeLandmarks(lm, other);
+                    }
+                    ++merged;
+                }
+            }
+            removeNonVisiblePoints();
+            ROS_INFO("MAP = Fused KF [%d] with [%lu] landmarks of [%lu] local KFs: [%lu] matches, [%u] observations added, [%u] landmarks merged, [%u] rejected [%.1fms]",
+                     f->getKfId(), candidates.size(), localKfs.size(), ms.size(), added, merged, rejected, (ros::WallTime::now()-t0).toSec()*1000.);
+        }
+
+
+        // Structure only refinement of all landmarks seen by f
+        void refineKF(const Frame::Ptr& f){
+            const Landmark::IntMap& refs = f->getLandmarkRefs();
+            Landmark::Ptrs lms;
+            for (Landmark::IntMap::const_iterator it = refs.begin(); it != refs.end(); ++it){
+                lms.push_back(it->second);
+            }
+            refiner.refine(lms);
+        }
+
+
+        // Mean squared image plane reprojection error of the landmarks observed by f, -1 if it observes none.
+        // Same units as the BA chi2 per observation, used by the BA scheduler
+        double reprojectionError(const Frame::Ptr& f) const{
+            const Landmark::IntMap& refs = f->getLandmarkRefs();
+            const Pose poseInv = f->getPose().inverse();
+            double error = 0;
+            uint nr = 0;
+            for (Landmark::IntMap::const_iterator it = refs.begin(); it != refs.end(); ++it){
+                const Bearing bv = f->getBearing(it->first);
+                const Point3d P = poseInv * it->second->getPosition();
+                if (P[2]<=0 || bv[2]<=0){
+                    continue;
+                }
+                error += (Eigen::Vector2d(bv[0]/bv[2], bv[1]/bv[2]) - Eigen::Vector2d(P[0]/P[2], P[1]/P[2])).squaredNorm();
+                ++nr;
+            }
+            return nr>0 ? error/nr : -1;
+        }
+
 
-            /// create solver
-            g2o::SparseOptimizer optimizer;
-            optimizer.setVerbose(true);
-            g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
-            if (g2oDense) {
-                linearSolver= new g2o::LinearSolverDense<g2o::BlockSolver_6_3::PoseMatrixType>();
+        // DO bundle adjustment over all points and observations. Synchronous unless asyncBA is set, in which case it is only started.
+        // The BA scheduler decides if it is needed and if it should be local or global.
+        // Returns false if no BA was done or started (disabled, skipped by the scheduler, or only queued behind a running one)
+        bool bundleAdjust(){
+            if (g2oIter==0){
+                return false;
+            }
+            const BAScheduler::Decision decision = baScheduler.decide(reprojectionError(currentFrame), baRunning);
+            if (decision==BAScheduler::BA_NONE){
+                return false;
+            }
+            // with the pose graph the keyframes outside the local window are kept consistent by it instead
+            baGlobal = decision==BAScheduler::BA_GLOBAL && !pgOn;
+            if (decision==BAScheduler::BA_GLOBAL && pgOn){
+                ROS_INFO("MAP = Pose graph on, doing a local BA instead of a global one");
+            }
+            if (asyncBA){
+                return startBA();
             } else {
-                linearSolver = new g2o::LinearSolverCholmod<g2o::BlockSolver_6_3::PoseMatrixType>();
+                ROS_INFO("MAP > Doing G2O Bundle adjustment with [%lu] KeyFrames and [%lu] LandMarks", keyframes.size(), landmarks.size());
+                ROS_INFO_STREAM(*this);
+                ros::WallTime tStart = ros::WallTime::now();
+                makeBAProblem(baProblem);
+                solveBA();
+                applyBA(baProblem);
+                ROS_INFO("MAP < Bundle Adjustment Finished [Total: %.1fms]", (ros::WallTime::now()-tStart).toSec()*1000.);
+                return true;
+            }
+        }
+
+
+        // Starts a BA in the background on a snapshot of the map. If one is already running, another one is started once that finishes
+        // and false is returned
+        bool startBA(){
+            if (baRunning){
+                ROS_INFO("MAP = BA still running, queueing another one");
+                baPending = true;
+                return false;
+            }
+            ros::WallTime t0 = ros::WallTime::now();
+            makeBAProblem(baProblem);
+            baPending = false;
+            baRunning = true;
+            {
+                boost::mutex::scoped_lock lock(baMutex);
+                baDone = false;
+            }
+            baThread = boost::thread(&OdoMap::baWorker, this);
+            ROS_INFO("MAP = Started background BA with [%lu] KeyFrames and [%lu] LandMarks, snapshot took [%.1fms]", baProblem.kfs.size(), baProblem.lms.size(), (ros::WallTime::now()-t0).toSec()*1000.);
+            return true;
+        }
+
+
+        // Picks up the results of a finished background BA. Call from the tracking thread only. Returns true if the map changed.
+        // correction is how the newest keyframe of the snapshot moved, poses estimated against the map before should follow it
+        bool collectBA(Pose& correction, const bool wait=false){
+            correction.setIdentity();
+            if (!baRunning){
+                return false;
+            }
+            if (!wait){
+                boost::mutex::scoped_lock lock(baMutex);
+                if (!baDone){
+                    return false;
+                }
+            }
+            baThread.join();
+            baRunning = false;
+            flushPoseGraphRemovals();
+            flushBAParameter();
+            correction = applyBA(baProblem);
+            if (baPending){
+                startBA();
             }
-            g2o::BlockSolver_6_3 * solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
-            g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
-            optimizer.setAlgorithm(solver);
+            return true;
+        }
 
-            // Some meta data to print with
-            bool ok;
-            int obsCount  = 0;
-            int lmCount    = 0;
-            int poseCount  = 0;
 
+        // Stops a running background BA and drops its results
+        void discardBA(){
+            if (baRunning){
+                ROS_WARN("MAP = Waiting for background BA to finish so we can discard it");
+                baThread.join();
+                baRunning = false;
+                flushPoseGraphRemovals();
+                flushBAParameter();
+            }
+            baPending = false;
+        }
 
-            /// Setup add frames
-            ROS_INFO("g2o = Adding [%lu] Keyframe poses", keyframes.size());
+
+
+        /// /////////////////////////////////////////////////////////////////////////////////
+        /// Bundle adjustment on a snapshot of the map. Only makeBAProblem and applyBA touch the map, the adjuster only the snapshot so it can run in another thread
+
+        // Copies keyframe poses, landmark positions and observations. With a local window only the newest baWindow keyframes
+        // and the landmarks they observe are optimised. Older keyframes observing these landmarks are added as fixed vertices
+        void makeBAProblem(BAProblem& p) const{
+            p.kfs.clear();
+            p.lms.clear();
+            p.obs.clear();
+            p.dense     = g2oDense;
+            p.iter      = g2oIter;
+            p.huber     = g2oHuber;
+            p.schur     = g2oSchur;
+            p.budget    = baBudget;
+            p.gain      = baGain;
+            p.global    = baGlobal || baWindow==0;
+            p.outlierChi2 = baOutlierChi2;
+            p.outlierIter = baOutlierIter;
+            p.marginals = pgOn;
+            p.structure = g2oStructure;
+            p.poseGraph = pgOn;
+            p.pgKfs.clear();
+            p.pgPairs.clear();
+            p.time      = -1;
+            p.iterations= 0;
+            p.chi2      = -1;
+            p.outliers.clear();
+            p.nrOutliers= 0;
+            p.poseCov.resize(0, 0);
+            p.poseCovInd.clear();
+            p.maxKfId   = keyframes.empty() ? -1 : keyframes.back()->getKfId();
+            p.maxLmId   = -1;
+
+            // keyframes outside the window are never optimised. The window is the newest baWindow keyframes, or with baCovis
+            // the newest one and its baWindow-1 most covisible ones
+            std::map<int, uint> kfIndex;
             for (uint i=0; i<keyframes.size();++i){
-                const Frame::Ptr& kf = keyframes[i];
-                // create pose
-                VertexPose* v_pose = new VertexPose();
-                // set estimate
-                v_pose->setEstimate(Eigen::Isometry3d(kf->getPose().matrix()));
-                // fix
-                if (g2oFix==FIX_NONE){
-                    v_pose->setFixed(false);
-                } else if (g2oFix==FIX_ALL){
-                    v_pose->setFixed(true);
-                } else if (i==keyframes.size()-1 && g2oFix==FIX_LAST){
-                    ROS_INFO("g2o = Fixing [Last] Keyframe [%d|%d] pose", kf->getId(), kf->getKfId());
-                    v_pose->setFixed(true);
-                } else if (i==0 && g2oFix==FIX_FIRST){
-                    ROS_INFO("g2o = Fixing [First] Keyframe [%d|%d] pose", kf->getId(), kf->getKfId());
-                    v_pose->setFixed(true);
-                } else if ((i==0 || i==keyframes.size()-1) && g2oFix==FIX_FIRST_LAST){
-                    v_pose->setFixed(true);
-                    ROS_INFO("g2o = Fixing [%s] Keyframe [%d|%d] pose", i==0 ? "First" : "Last", kf->getId(), kf->getKfId());
-                }
-                v_pose->setId(kf->getKfId()); //set id using unique statid id of keyframe class
-                poseCount++;
-
-                ok = optimizer.addVertex(v_pose);
-                ROS_ASSERT_MSG(ok, "g2o = Could not add v_pose of frame [%d|%d] to pose graph", kf->getId(), kf->getKfId());
-            }
-            ROS_INFO("g2o = Added [%d] Keyframe poses", poseCount);
-
-            /// TODO: do we need to add pose-pose edges??
-
-
-            /// Setup add land marks
-            ROS_INFO("g2o = Adding up to [%lu landmarks], adding observations", landmarks.size());
+                kfIndex[keyframes[i]->getKfId()] = i;
+            }
+            Bools kfActive(keyframes.size(), true);
+            if (!p.global && keyframes.size()>baWindow){
+                const uint firstActive = keyframes.size()-baWindow;
+                Frame::Ptrs covisible;
+                if (baCovis && baWindow>1){
+                    covisible = covis.getCovisibleKFs(keyframes.back()->getKfId(), baWindow-1, covisMin);
+                }
+                for (uint i=0; i<keyframes.size();++i){
+                    kfActive[i] = baCovis ? i==keyframes.size()-1 : i>=firstActive;
+                }
+                for (uint i=0; i<covisible.size();++i){
+                    kfActive[kfIndex[covisible[i]->getKfId()]] = true;
+                }
+            }
+            const uint nrActive = std::count(kfActive.begin(), kfActive.end(), true);
+            Bools kfUsed(keyframes.size(), false);
+
+            p.lms.reserve(landmarks.size());
             for (uint i=0; i<landmarks.size(); ++i){
                 const Landmark::Ptr& lm = landmarks[i];
-                uint obsNr = lm->getObservationsNr();
+                p.maxLmId = std::max(p.maxLmId, lm->getId());
+                const uint obsNr = lm->getObservationsNr();
                 ROS_ASSERT(obsNr>0);
-
                 // Make sure we can still triangulate, need at least two observations
-                if (obsNr==1){
-                    /// TODO: Fix the position of the point relative to the landmark
-                    /// or remove the point all toegther...
+                /// TODO: Fix the position of the point relative to the landmark or remove the point all toegther...
+                if (obsNr<2){
+                    continue;
+                }
+                // Must be seen by the window
+                bool inWindow = false;
+                for (uint fid=0; fid<obsNr && !inWindow; ++fid){
+                    inWindow = kfActive[kfIndex[lm->getObservationFrame(fid)->getKfId()]];
+                }
+                if (!inWindow){
+                    continue;
+                }
+                BAProblem::LM l;
+                l.id = lm->getId();
+                l.position = lm->getPosition();
+                p.lms.push_back(l);
+                for (uint fid=0; fid<obsNr; ++fid){
+                    const Bearing bv = lm->getObservationBearing(fid);
+                    BAProblem::Obs o;
+                    o.kfId = lm->getObservationFrame(fid)->getKfId();
+                    o.lmId = l.id;
+                    o.measurement = Eigen::Vector2d(bv[0]/bv[2], bv[1]/bv[2]); //bearing vector -> image plane (from norm==1 to depth==1)
+                    p.obs.push_back(o);
+                    kfUsed[kfIndex[o.kfId]] = true;
+                }
+            }
 
-                } else {
-                    VertexLandmarkXYZ * v_lm = new VertexLandmarkXYZ();
-                    v_lm->setId(lm->getId()+MAX_KF); //set id using unique static id of landmark class + offset
-                    v_lm->setMarginalized(true);
-                    v_lm->setFixed(false);
-                    v_lm->setEstimate(lm->getPosition());
-                    ok = optimizer.addVertex(v_lm);
-                    ++lmCount;
-                    ROS_ASSERT_MSG(ok, "g2o = Could not add v_landmark [%d] to pose graph", lm->getId());
-
-                    /// Setup add observations
-                    for (uint fid=0; fid<obsNr; ++fid){
-                        // Add each observation of this landmark. The landmark knows from which KFs it is visible and we use these kf IDS to associate the edge to the correct KF
-                        const Frame::Ptr& kf = lm->getObservationFrame(fid); //reference to the frame that observes this land mark
-                        const Bearing&  bv = lm->getObservationBearing(fid); //reference to observation
-                        EdgePoseLandmarkReprojectBV * ef = new EdgePoseLandmarkReprojectBV();
-                        ef->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(kf->getKfId()))); //get association via KF id
-                        ef->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(v_lm));
-                        ef->setMeasurement(Eigen::Vector2d(bv[0]/bv[2], bv[1]/bv[2])); //bearing vector -> image plane (from norm==1 to depth==1)
-                        ef->setInformation(Eigen::Matrix2d::Identity());
-                        if (g2oHuber) {
-                            g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                            ef->setRobustKernel(rk);
+            p.kfs.reserve(nrActive);
+            for (uint i=0; i<keyframes.size();++i){
+                if (!kfActive[i] && !kfUsed[i]){
+                    continue;
+                }
+                const Frame::Ptr& kf = keyframes[i];
+                BAProblem::KF k;
+                k.kfId  = kf->getKfId();
+                k.pose  = kf->getPose();
+                k.fixed = !kfActive[i] || g2oFix==FIX_ALL ||
+                          (i==keyframes.size()-1 && (g2oFix==FIX_LAST || g2oFix==FIX_FIRST_LAST)) ||
+                          (i==0 && (g2oFix==FIX_FIRST || g2oFix==FIX_FIRST_LAST));
+                p.kfs.push_back(k);
+            }
+
+            // the pose graph covers all keyframes, edges between consecutive ones and covisible ones of the problem
+            if (p.poseGraph){
+                p.pgKfs.reserve(keyframes.size());
+                for (uint i=0; i<keyframes.size();++i){
+                    BAProblem::KF k;
+                    k.kfId  = keyframes[i]->getKfId();
+                    k.pose  = keyframes[i]->getPose();
+                    k.fixed = false;
+                    p.pgKfs.push_back(k);
+                }
+                for (uint a=0; a<p.kfs.size(); ++a){
+                    for (uint b=a+2; b<p.kfs.size(); ++b){
+                        if (covis.getWeight(p.kfs[a].kfId, p.kfs[b].kfId)>=covisMin){
+                            p.pgPairs.push_back(std::make_pair(p.kfs[a].kfId, p.kfs[b].kfId));
                         }
-                        ok = optimizer.addEdge(ef);
-                        ++obsCount;
-                        ROS_ASSERT_MSG(ok, "g2o = Could not add edge between Landmark [%d] and frame [%d|%d] to pose graph", lm->getId(), kf->getId(), kf->getKfId());
                     }
                 }
+            }
+            ROS_INFO("MAP = BA problem: [%lu/%lu] KFs of which [%lu] in the window, [%lu/%lu] LMs, [%lu] observations",
+                     p.kfs.size(), keyframes.size(), nrActive, p.lms.size(), landmarks.size(), p.obs.size());
+        }
+
 
+        // Writes the BA results back to the map. Keyframes and landmarks removed in the mean time are ignored,
+        // ones added after the snapshot are moved with the correction of the newest optimised keyframe, which is returned
+        Pose applyBA(const BAProblem& p){
+            ros::WallTime t0 = ros::WallTime::now();
+            Pose correction;
+            correction.setIdentity();
+            if (p.kfs.empty()){
+                return correction;
             }
-            ROS_INFO("g2o = Added [%d/%lu] landmarks", lmCount, landmarks.size());
-            ROS_INFO("g2o = Added [%d] pose-landmark edges", obsCount);
-            ros::WallTime tSetup = ros::WallTime::now();
-            ROS_INFO("g2o = Finished setting up [%.1fms]", (tSetup-tStart).toSec()*1000.);
+            baScheduler.addResult(p.global, p.time, p.obs.empty() ? 0 : p.chi2/p.obs.size());
 
+            std::map<int, uint> kfInd;
+            for (uint i=0; i<p.kfs.size(); ++i){
+                kfInd[p.kfs[i].kfId] = i;
+            }
+            std::map<int, uint> lmInd;
+            for (uint i=0; i<p.lms.size(); ++i){
+                lmInd[p.lms[i].id] = i;
+            }
 
-            /// Run optimisation
-            optimizer.initializeOptimization();
-            optimizer.setVerbose(true);
-            if (g2oStructure){
-                g2o::StructureOnlySolver<3> structure_only_ba;
-                ROS_INFO("g2o = Doing structure-only BA First");
-                g2o::OptimizableGraph::VertexContainer points;
-                for (g2o::OptimizableGraph::VertexIDMap::const_iterator it = optimizer.vertices().begin(); it != optimizer.vertices().end(); ++it) {
-                    g2o::OptimizableGraph::Vertex* v = static_cast<g2o::OptimizableGraph::Vertex*>(it->second);
-                    if (v->dimension() == 3){
-                        points.push_back(v);
+            // correction for everything created after the snapshot
+            Frame::Ptr newest;
+            for (uint i=0; i<keyframes.size();++i){
+                if (keyframes[i]->getKfId()==p.maxKfId){
+                    newest = keyframes[i];
+                }
+            }
+            if (!newest.empty() && kfInd.count(p.maxKfId)){
+                correction = p.kfs[kfInd[p.maxKfId]].pose * newest->getPose().inverse();
+            }
+
+            uint kfUpdated = 0, kfMoved = 0;
+            for (uint i=0; i<keyframes.size();++i){
+                Frame::Ptr& kf = keyframes[i];
+                std::map<int, uint>::const_iterator it = kfInd.find(kf->getKfId());
+                Pose pose;
+                if (it != kfInd.end()){
+                    pose = p.kfs[it->second].pose;
+                    ++kfUpdated;
+                } else if (kf->getKfId() > p.maxKfId){
+                    pose = correction * kf->getPose();
+                    ++kfMoved;
+                } else {
+                    continue;
+                }
+                kf->setPose(pose);
+            }
+
+            uint lmUpdated = 0, lmMoved = 0;
+            for (uint i=0; i<landmarks.size(); ++i){
+                Landmark::Ptr& lm = landmarks[i];
+                std::map<int, uint>::const_iterator it = lmInd.find(lm->getId());
+                if (it != lmInd.end()){
+                    lm->setPosition(p.lms[it->second].position);
+                    ++lmUpdated;
+                } else if (lm->getId() > p.maxLmId){
+                    lm->setPosition(correction * lm->getPosition());
+                    ++lmMoved;
+                }
+            }
+
+            ROS_INFO("MAP = Applied BA results [%u KFs, %u LMs] and moved [%u KFs, %u LMs] added since in [%.1fms]. BA took [%.1fms]",
+                     kfUpdated, lmUpdated, kfMoved, lmMoved, (ros::WallTime::now()-t0).toSec()*1000., p.time*1000.);
+
+            if (p.nrOutliers>0){
+                cullOutliers(p);
+            }
+            if (p.poseGraph){
+                applyPoseGraph(p);
+            }
+            return correction;
+        }
+
+
+        // Adds the relative poses BA measured between consecutive and covisible keyframes to the pose graph, weighted by the
+        // BA marginals. Then the keyframes BA did not optimise are optimised over the graph with the ones it did fixed.
+        // Only touches p and the pose graph, runs after the BA in the worker. applyPoseGraph writes the result to the map
+        void solvePoseGraph(BAProblem& p){
+            ros::WallTime t0 = ros::WallTime::now();
+            std::set<std::pair<int, int> > pairs(p.pgPairs.begin(), p.pgPairs.end());
+
+            /// New edges
+            const bool haveCov = p.poseCov.rows()>0;
+            const PoseGraph::Matrix6d zero = PoseGraph::Matrix6d::Zero();
+            uint edgesSet = 0;
+            for (uint a=0; a<p.kfs.size(); ++a){
+                const BAProblem::KF& ka = p.kfs[a];
+                for (uint b=a+1; b<p.kfs.size(); ++b){
+                    const BAProblem::KF& kb = p.kfs[b];
+                    if (ka.fixed && kb.fixed){
+                        continue;
                     }
+                    // consecutive or covisible
+                    if (b>a+1 && !pairs.count(std::make_pair(ka.kfId, kb.kfId))){
+                        continue;
+                    }
+                    PoseGraph::Matrix6d information = PoseGraph::Matrix6d::Identity();
+                    if (haveCov){
+                        const int ia = p.poseCovInd[a];
+                        const int ib = p.poseCovInd[b];
+                        // a fixed keyframe has no uncertainty
+                        information = PoseGraph::relativeInformation(ka.pose, kb.pose,
+                                        ia<0 ? zero : PoseGraph::Matrix6d(p.poseCov.block<6,6>(6*ia, 6*ia)),
+                                        ib<0 ? zero : PoseGraph::Matrix6d(p.poseCov.block<6,6>(6*ib, 6*ib)),
+                                        (ia<0 || ib<0) ? zero : PoseGraph::Matrix6d(p.poseCov.block<6,6>(6*ia, 6*ib)));
+                    }
+                    poseGraph.setEdge(ka.kfId, kb.kfId, ka.pose.inverse()*kb.pose, information);
+                    ++edgesSet;
                 }
-                structure_only_ba.calc(points, g2oIter);
             }
-            //optimizer.save((ros::package::getPath("ollieRosTools")+"/data/map_ba.g2o").c_str());
-            ROS_INFO("g2o > Performing full BA:");
-            optimizer.optimize(g2oIter);
-            ros::WallTime tOpt = ros::WallTime::now();
-            ROS_INFO("g2o < Done BA [Setup: %.1fms] [Opti: %.1fms]",  (tSetup-tStart).toSec()*1000., (tOpt-tSetup).toSec()*1000. );
 
+            /// Optimise everything but what BA just optimised, that starts from the BA result
+            std::map<int, uint> kfInd;
+            for (uint i=0; i<p.kfs.size(); ++i){
+                kfInd[p.kfs[i].kfId] = i;
+            }
+            for (uint i=0; i<p.pgKfs.size(); ++i){
+                BAProblem::KF& k = p.pgKfs[i];
+                std::map<int, uint>::const_iterator it = kfInd.find(k.kfId);
+                k.fixed = it != kfInd.end() && !p.kfs[it->second].fixed;
+                if (k.fixed){
+                    k.pose = p.kfs[it->second].pose;
+                }
+            }
+            const int iterations = poseGraph.optimize(p.pgKfs);
+            if (iterations==0){
+                // nothing moved, applyPoseGraph skips everything
+                for (uint i=0; i<p.pgKfs.size(); ++i){
+                    p.pgKfs[i].fixed = true;
+                }
+            }
+            ROS_INFO("PGO = Added [%u] edges, optimised [%lu] KFs in [%d] iterations [%.1fms]", edgesSet, p.pgKfs.size(), iterations, (ros::WallTime::now()-t0).toSec()*1000.);
+        }
 
-            // Update map using BA results
-            /// Update frames - FOR NOW ALL OF THEM, /// TODO sliding window
-            ROS_INFO("g2o = Updating [%d] Keyframe poses", poseCount);
+
+        // Moves the keyframes the pose graph optimised. Landmarks BA did not touch follow the correction of the first of their
+        // keyframes that moved. Keyframes and landmarks removed or added since the snapshot are skipped
+        void applyPoseGraph(const BAProblem& p){
+            ros::WallTime t0 = ros::WallTime::now();
+            std::map<int, uint> pgInd;
+            for (uint i=0; i<p.pgKfs.size(); ++i){
+                pgInd[p.pgKfs[i].kfId] = i;
+            }
+
+            std::vector<Pose, Eigen::aligned_allocator<Pose> > corrections(keyframes.size(), Pose::Identity());
+            Bools moved(keyframes.size(), false);
+            std::map<int, uint> kfIndex;
+            uint kfMoved = 0;
             for (uint i=0; i<keyframes.size();++i){
-                Frame::Ptr& kf = keyframes[i];
-                Pose poseEstimate = dynamic_cast<VertexPose*>(optimizer.vertex(kf->getKfId()))->estimate();
-                kf->setPose(poseEstimate);
+                kfIndex[keyframes[i]->getKfId()] = i;
+                std::map<int, uint>::const_iterator it = pgInd.find(keyframes[i]->getKfId());
+                if (it == pgInd.end() || p.pgKfs[it->second].fixed){
+                    continue;
+                }
+                const Pose& pose = p.pgKfs[it->second].pose;
+                corrections[i] = pose * keyframes[i]->getPose().inverse();
+                keyframes[i]->setPose(pose);
+                moved[i] = true;
+                ++kfMoved;
+            }
+            if (kfMoved==0){
+                return;
             }
 
-            /// Update Landmarks
-            ROS_INFO("g2o = Updating [%d landmarks]", lmCount);
+            std::set<int> lmOptimised;
+            for (uint i=0; i<p.lms.size(); ++i){
+                lmOptimised.insert(p.lms[i].id);
+            }
+            uint lmMoved = 0;
             for (uint i=0; i<landmarks.size(); ++i){
                 Landmark::Ptr& lm = landmarks[i];
-                if (lm->getObservationsNr()>1){
-                    VertexLandmarkXYZ* v;
-                    v = dynamic_cast<VertexLandmarkXYZ*>(optimizer.vertex(MAX_KF+lm->getId()));
-                    Point3d positionEstimate = v->estimate();
-                    lm->setPosition(positionEstimate);
+                if (lm->getId() > p.maxLmId || lmOptimised.count(lm->getId())){
+                    continue;
+                }
+                for (uint o=0; o<lm->getObservationsNr(); ++o){
+                    const uint k = kfIndex[lm->getObservationFrame(o)->getKfId()];
+                    if (moved[k]){
+                        lm->setPosition(corrections[k] * lm->getPosition());
+                        ++lmMoved;
+                        break;
+                    }
                 }
             }
+            ROS_INFO("MAP = Applied pose graph, moved [%u KFs, %u LMs] [%.1fms]", kfMoved, lmMoved, (ros::WallTime::now()-t0).toSec()*1000.);
+        }
 
-            optimizer.clear();
 
-            ros::WallTime tEnd = ros::WallTime::now();
-            ROS_INFO("MAP < Bundle Adjustment Finished [Setup: %.1fms] [Opti: %.1fms] [Update: %.1fms] [Total: %.1fms]",
-                     (tSetup-tStart).toSec()*1000., (tOpt-tSetup).toSec()*1000., (tEnd-tOpt).toSec()*1000., (tEnd-tStart).toSec()*1000. );
+        // Removes the observations BA flagged as outliers from their landmarks and keyframes. Landmarks left with fewer than
+        // two observations can not be constrained any more and are dropped. Ones removed since the snapshot are skipped
+        void cullOutliers(const BAProblem& p){
+            ros::WallTime t0 = ros::WallTime::now();
+            std::map<int, Landmark::Ptr> lmById;
+            for (uint i=0; i<landmarks.size(); ++i){
+                lmById[landmarks[i]->getId()] = landmarks[i];
+            }
+
+            uint obsRemoved = 0;
+            Landmark::Ptrs culled;
+            for (uint i=0; i<p.obs.size(); ++i){
+                if (!p.outliers[i]){
+                    continue;
+                }
+                std::map<int, Landmark::Ptr>::const_iterator it = lmById.find(p.obs[i].lmId);
+                if (it == lmById.end()){
+                    continue;
+                }
+                const Landmark::Ptr& lm = it->second;
+                for (uint o=0; o<lm->getObservationsNr(); ++o){
+                    const FramePtr f = lm->getObservationFrame(o);
+                    if (f->getKfId()==p.obs[i].kfId){
+                        covis.removeObservation(f->getKfId(), lm);
+                        f->removeLandMarkRef(lm->getObservationPointId(o));
+                        culled.push_back(lm);
+                        ++obsRemoved;
+                        break;
+                    }
+                }
+            }
 
+            uint lmsDropped = 0;
+            for (uint i=0; i<culled.size(); ++i){
+                // a landmark may be in culled several times, only the first visit sees one observation left
+                if (culled[i]->getObservationsNr()==1){
+                    // the last observation shares nothing any more, the graph is not affected
+                    culled[i]->getObservationFrame(0)->removeLandMarkRef(culled[i]->getObservationPointId(0));
+                    ++lmsDropped;
+                }
+            }
+            removeNonVisiblePoints();
+            ROS_INFO("MAP = Culled [%u/%u] outlier observations and dropped [%u] landmarks left with less than two in [%.1fms]",
+                     obsRemoved, p.nrOutliers, lmsDropped, (ros::WallTime::now()-t0).toSec()*1000.);
         }
 
 
@@ -632,13 +1322,34 @@ class OdoMap {
         void setParameter(ollieRosTools::VoNode_paramsConfig &config, uint32_t level){
             ROS_INFO("MAP > SETTING PARAMS");
             maxKFNr = config.map_maxKF;
+            kfCull      = config.map_kfCull;
+            kfCullObs   = config.map_kfCullObs;
+            kfCullRatio = config.map_kfCullRatio;
+            localKFs    = config.map_localKFs;
+            covisMin    = config.map_covisMin;
+            baCovis     = config.g2o_covisWindow;
+            fuseKFs     = config.map_fuseKFs;
+            fuseBV      = OVO::px2error(config.map_fusePx);
+            fuseDepth   = config.map_fuseDepth;
             shirnkKFs();
 
             g2oDense     = config.g2o_dense;
             g2oIter      = config.g2o_iterations;
             g2oHuber     = config.g2o_huber;
             g2oStructure = config.g2o_structureOnly;
+            refineNew    = config.map_refineNew;
+            refiner.setParameter(config, level);
+            setBAParameter(config, level);
+            g2oSchur     = config.g2o_schur;
             g2oFix       = static_cast<FixMethod>(config.g2o_fix);
+            asyncBA      = config.map_asyncBA;
+            baWindow     = config.g2o_localWindow;
+            baBudget     = config.g2o_budget/1000.;
+            baGain       = config.g2o_gain;
+            // same px -> image plane conversion as the structure refiner
+            baOutlierChi2 = config.g2o_outlierThresh>0 ? OVO::px2tangentSq(config.g2o_outlierThresh) : 0;
+            baOutlierIter = config.g2o_outlierIter;
+            pgOn         = config.pg_on;
 
             matcher.setParameter(config, level);
             ROS_INFO("MAP < PARAMS SET");
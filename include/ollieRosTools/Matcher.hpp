@@ -32,6 +32,9 @@ bool isSorted(const DMatches& ms);
 // sorts matches by increaseing distance
 void sortMatches(DMatches& ms);
 
+// Indices of the matches sorted by increasing distance, leaving the matches themselves untouched
+void sortMatchesInd(const DMatches& ms, Ints& order);
+
 // Reduces vector of vectors DMatchesKNN to a single vector DMatches
 void matchKnn2single(const DMatchesKNN& msknn, DMatches& ms, const size_t maxPerMatch);
 
@@ -135,6 +138,7 @@ class Matcher{
         Prediction m_pred;
         double m_bvDisparityThresh;
         double m_bvDisparityThreshMap;
+        double m_bvDisparityThreshPred;
 
         /// KLT Settings
         cv::Point klt_window;
@@ -161,6 +165,17 @@ class Matcher{
         // Match f against kframe. Returns angular disparity error
         double matchFrame(FramePtr f, FramePtr kf, DMatches& matches, double& time, const Ints& fMask=Ints(), const Ints& kfMask=Ints(), const FramePtr fClose = FramePtr(), bool triangulation=false);
 
+        // Match f against kframe given a predicted pose of f. KF landmarks are projected into f, so the gate can be much tighter. Returns angular disparity error f vs kf
+        double matchFramePredicted(FramePtr f, FramePtr kf, const Pose& fPose, DMatches& matches, double& time, const Ints& kfMask=Ints());
+
+        // Match f against kframe given the bearings of the kf keypoints predicted in f (rows aligned with the kf keypoints), eg
+        // depth filter seeds projected at their mean depth. Gated with the unpredicted disparity threshold. Returns angular disparity error vs the prediction
+        double matchFrameBearings(FramePtr f, FramePtr kf, const Eigen::MatrixXd& kfBVPred, DMatches& matches, double& time, const Ints& kfMask=Ints());
+
+        // Track the keypoints of fPrev that are matched against kf (prevMatches: fPrev vs kf) into f with pyramidal KLT. No detection or extraction
+        // on f, its keypoints are replaced by the tracked ones. Returns matches f vs kf and the angular disparity error f vs kf
+        double trackFrame(FramePtr f, FramePtr fPrev, FramePtr kf, const DMatches& prevMatches, DMatches& matches, double& time);
+
 
 
 
@@ -0,0 +1,127 @@
+#ifndef MOTIONMODEL_HPP
+#define MOTIONMODEL_HPP
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <ros/ros.h>
+#include <ollieRosTools/VoNode_paramsConfig.h>
+#include <ollieRosTools/aux.hpp>
+#include <ollieRosTools/Frame.hpp>
+
+
+
+/// Constant velocity motion model on SE(3). Keeps the body frame twist (per second) between the last two frames
+/// with an estimated pose and extrapolates it to the time of a new frame. With an IMU the predicted rotation is
+/// replaced by the last pose rotated by the IMU rotation difference, which is much more reliable than extrapolating.
+/// The prediction is used to gate matching and as a pose hypothesis that can replace RANSAC.
+class MotionModel {
+public:
+    MotionModel():
+        on(false),
+        maxAge(0.5),
+        haveLast(false),
+        haveVelocity(false),
+        w(Eigen::Vector3d::Zero()),
+        v(Eigen::Vector3d::Zero()){
+        lastPose.setIdentity();
+        lastImu.setIdentity();
+    }
+
+    void reset(){
+        haveLast = false;
+        haveVelocity = false;
+        w.setZero();
+        v.setZero();
+        ROS_INFO("MOT = Motion model reset");
+    }
+
+    /// Predicts the pose of f. Returns false if we have no recent velocity estimate
+    bool predict(const FramePtr& f, Pose& prediction) const {
+        if (!on || !haveLast || !haveVelocity){
+            return false;
+        }
+        const double dt = (f->getTime()-lastTime).toSec();
+        if (dt<=0 || dt>maxAge){
+            ROS_WARN("MOT = No prediction, last pose is [%.1fms] old", dt*1000.);
+            return false;
+        }
+
+        // Extrapolate the twist
+        Pose delta;
+        delta.setIdentity();
+        const double angle = w.norm()*dt;
+        if (angle>1e-12){
+            delta.linear() = Eigen::AngleAxisd(angle, w.normalized()).toRotationMatrix();
+        }
+        delta.translation() = v*dt;
+        prediction = lastPose * delta;
+
+        // The IMU rotation beats the extrapolated one
+        if (USE_IMU){
+            Eigen::Matrix3d relRot;
+            OVO::relativeRotation(lastImu, f->getImuRotation(), relRot);
+            prediction.linear() = lastPose.linear() * relRot;
+        }
+
+        ROS_INFO("MOT = Predicted pose [%.1fms] ahead: moved [%.3f] rotated [%.2f deg]", dt*1000., (v*dt).norm(), angle*toDeg);
+        return true;
+    }
+
+    /// Call with every frame that has a final pose estimate
+    void update(const FramePtr& f){
+        if (!on){
+            return;
+        }
+        ROS_ASSERT(f->poseEstimated());
+        const Pose& pose = f->getPose();
+        const double dt = (f->getTime()-lastTime).toSec();
+
+        if (haveLast && dt>0 && dt<=maxAge){
+            const Pose delta = lastPose.inverse() * pose;
+            const Eigen::AngleAxisd aa(delta.linear());
+            w = aa.axis()*aa.angle()/dt;
+            v = delta.translation()/dt;
+            haveVelocity = true;
+        } else {
+            // Too old to say anything about the current velocity
+            w.setZero();
+            v.setZero();
+            haveVelocity = false;
+        }
+
+        lastPose = pose;
+        lastImu = f->getImuRotation();
+        lastTime = f->getTime();
+        haveLast = true;
+    }
+
+    /// The map moved by correction (eg after a background BA), move the last pose with it so the jump does not look like motion.
+    /// The velocity is in the last camera frame and stays the same
+    void applyCorrection(const Pose& correction){
+        lastPose = correction * lastPose;
+    }
+
+    bool isOn() const {return on;}
+
+    void setParameter(ollieRosTools::VoNode_paramsConfig &config, uint32_t level){
+        if (on && !config.vo_mmOn){
+            reset();
+        }
+        on     = config.vo_mmOn;
+        maxAge = config.vo_mmMaxAge/1000.;
+    }
+
+private:
+    bool on;
+    double maxAge; // seconds, dont extrapolate further than this
+
+    bool haveLast;
+    bool haveVelocity;
+    Pose lastPose;
+    Eigen::Matrix3d lastImu;
+    ros::Time lastTime;
+    Eigen::Vector3d w; // angular velocity, axis*angle per second in the last camera frame
+    Eigen::Vector3d v; // linear velocity per second in the last camera frame
+};
+
+#endif // MOTIONMODEL_HPP
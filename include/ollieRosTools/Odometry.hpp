@@ -37,6 +37,11 @@
 #include <ollieRosTools/aux.hpp>
 #include <ollieRosTools/Frame.hpp>
 #include <ollieRosTools/Map.hpp>
+#include <ollieRosTools/MotionModel.hpp>
+#include <ollieRosTools/PoseOptimizer.hpp>
+#include <ollieRosTools/DepthFilter.hpp>
+#include <ollieRosTools/ParallelRansac.hpp>
+#include <ollieRosTools/Triangulation.hpp>
 
 #include <ollieRosTools/custom_types/edge_pose_landmark_reprojectBV.hpp>
 #include <ollieRosTools/custom_types/vertex_landmarkxyz.hpp>
@@ -92,6 +97,19 @@ private:
     double disparity;
     // last computed disparity f vs map
     double disparityMap;
+    // false if the current frame may only be tracked (no KF, init or BA), set by the scheduler
+    bool kfAllowed;
+    // constant velocity motion model and its prediction for the current frame
+    MotionModel motion;
+    Pose posePredicted;
+    bool havePrediction;
+    // motion only pose refinement against fixed landmarks
+    PoseOptimizer poseOpt;
+    // inverse depth seeds on the latest KF, new landmarks come from the converged ones
+    DepthFilter seeds;
+    // KLT tracking: last frame with a pose and its matches against the latest KF (identity on the landmarks if it is the KF)
+    FramePtr kltPrev;
+    DMatches kltPrevMatches;
     // for outputting to tviz
     geometry_msgs::PoseArray trackPoses;
     visualization_msgs::Marker trackLines;
@@ -100,15 +118,25 @@ private:
     /// SETTINGS
     // RELATIVE POSE - used by initialisation
     int voTriangulationMethod;
+    double voTriMinParallax;  // degrees
     bool voRelNLO;
     double voRelRansacThresh;
     int voRelRansacIter;
     int voRelPoseMethod;    
     int voAbsPoseMethod;
     int voAbsRansacIter;
+    int voRansacThreads;
+    bool voRansacProsac;
+    bool voRansacSprt;
+    bool voImuSolvers;      // use the known rotation solvers whenever we have an IMU
+    int voMmMinInliers;     // predicted pose replaces RANSAC if it has at least this many inliers
+    double voMmMinRatio;    // and at least this inlier ratio
+    bool voKltTracking;     // track non keyframes with KLT instead of detecting and matching descriptors
+    int voKltMinTracks;     // fall back to descriptor matching below this many tracks
     int lostThresh;
     double voAbsRansacThresh;
     bool voAbsNLO;
+    bool voPoseOpt;         // refine with the PoseOptimizer instead of NLO, also used to refine the motion model prediction
     double voInitDisparity;   // disparity required to trigger initialisation
     double voKfDisparity;     // disparity required to trigger new KF
     float frameQualityThreshold;
@@ -169,30 +197,25 @@ private:
 
 
     /// Triangulate points points3d using bearing vectors bv1 and bv2 and the estimated pose between them trans1to2.
-    void triangulate(const Pose& trans1to2, const Bearings& bv1, const Bearings& bv2, Points3d& points3d) const{
-        /// The 3D points are expressed in the frame of the first viewpoint.
+    // Triangulates aligned bearing vectors in one batch. The 3D points are expressed in the frame of the first viewpoint.
+    // valid[i] is false if point i lies behind a camera, has too little parallax or reprojects with an error above maxError (0 = dont check)
+    void triangulate(const Pose& trans1to2, const Bearings& bv1, const Bearings& bv2, Points3d& points3d, Bools& valid, const double maxError=0) const{
         ros::WallTime t0 = ros::WallTime::now();
-        ROS_INFO("OVO [U] > Triangulating");
-
-
-        // Triangulate point pairs of each match
-        opengv::relative_pose::CentralRelativeAdapter adapter(bv1, bv2, trans1to2.translation(), trans1to2.linear() );
-
-        points3d.clear();
-        points3d.reserve(bv1.size());
+        ROS_INFO("OVO [U] > Triangulating [%lu] points", bv1.size());
 
         if (voTriangulationMethod==0){
             //dont do
-        } else if (voTriangulationMethod==1){
-            for(uint i = 0; i < bv1.size(); ++i){
-                points3d.push_back(opengv::triangulation::triangulate(adapter,i));
-            }
-        } else if (voTriangulationMethod==2){
-            for(uint i = 0; i < bv1.size(); ++i){
-               points3d.push_back(opengv::triangulation::triangulate(adapter,i));
-            }
+            points3d.clear();
+            valid.clear();
+            return;
         }
-        ROS_INFO("OVO [U] < Triangulated in [%f.1ms]",1000*(ros::WallTime::now()-t0).toSec() );
+
+        OVO::BearingsSoA bvSoA1, bvSoA2;
+        OVO::bearings2SoA(bv1, bvSoA1);
+        OVO::bearings2SoA(bv2, bvSoA2);
+        OVO::triangulateBatch(trans1to2, bvSoA1, bvSoA2, points3d, valid, static_cast<OVO::TRIANGULATION_METHOD>(voTriangulationMethod), voTriMinParallax, maxError);
+
+        ROS_INFO("OVO [U] < Triangulated [%ld/%lu] valid points in [%.1fms]", std::count(valid.begin(), valid.end(), true), valid.size(), 1000*(ros::WallTime::now()-t0).toSec() );
     }
 
 
@@ -231,6 +254,18 @@ private:
     // Update local variables, perform VO methods, called by medium level functions
 
 
+    /// Common RANSAC settings. ms must be aligned with the correspondences of the problem
+    template <class RANSAC>
+    void setRansacOptions(RANSAC& ransac, const DMatches& ms) const {
+        ransac.threads_ = voRansacThreads;
+        ransac.sprt_    = voRansacSprt;
+        if (voRansacProsac){
+            // Sample the matches with the lowest descriptor distance first
+            sortMatchesInd(ms, ransac.prosac_order_);
+        }
+    }
+
+
     /// adds a keyframe to the map
     // returns true on success
     bool addKf(FramePtr f){
@@ -252,19 +287,6 @@ private:
 
         disparity = map.match2Map(f, matches, lms, t); timeMA += t;
 
-        // Show common observations
-        std::map<FramePtr,int> kfObsCounter;
-        for (uint i=0; i<matches.size(); ++i){
-            ++kfObsCounter[lms[matches[i].trainIdx]->getObservationFrame()]; //histogram, count which kfs we f shared observations which
-        }
-        ROS_INFO(OVO::colorise("MAP = MATCHED Shared Observations with with Frame [%d|%d]:", OVO::FG_BLUE).c_str(), f->getId(), f->getKfId());
-        ROS_INFO("   KEYFRAME   | OBS NR");
-        for(std::map<FramePtr,int>::const_iterator it=kfObsCounter.begin(); it!=kfObsCounter.end(); ++it) {
-            ROS_INFO("   [%3d|%4d] | %3d/%d",it->first->getId(), it->first->getKfId(), it->second,  it->first->getLandmarkRefNr());
-        }
-
-
-
 
         // Check we could match enough
         if (matches.size()<5){
@@ -305,10 +327,11 @@ private:
             boost::shared_ptr<opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem>absposeproblem_ptr(
                         new opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem(adapter,
                             static_cast<opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem::Algorithm>(voAbsPoseMethod)) );
-            opengv::sac::Ransac<opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem> ransac;
+            ParallelRansac<opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem> ransac;
             ransac.sac_model_ = absposeproblem_ptr;
             ransac.threshold_ = voAbsRansacThresh*2; /// TODO: this should be a new dynamic reconfigure variable!
             ransac.max_iterations_ = voAbsRansacIter;
+            setRansacOptions(ransac, matches);
 
             ROS_INFO("ODO > Computing RANSAC absolute pose estimate vs MAP over [%lu matches] with [threshold = %f] ", matches.size(), ransac.threshold_);
             ransac.computeModel(1);
@@ -362,17 +385,11 @@ private:
 
         /// Add observations to landmarks
         ROS_INFO("ODO = Adding [%lu] landmark observations from Frame [%d|%d]", matchesVO.size(), f->getId(), f->getKfId());
-        std::map<FramePtr,int> kfObsCounterVO; //TODO: use std::map<FramePtr,int> kfObsCounter; // with key ->getId()
+        // shared observations with other keyframes are counted by the covisibility graph once the frame is pushed
         for (uint i=0; i<matchesVO.size(); ++i){
             Landmark::Ptr lm = lms[matchesVO[i].trainIdx];
             f ->addLandMarkRef(matchesVO[i].queryIdx, lm);
             lm->addObservation( f, matchesVO[i].queryIdx);
-            ++kfObsCounterVO[lm->getObservationFrame()]; //histogram, count which kfs we f shared observations which
-        }
-        ROS_INFO(OVO::colorise("ODO = ACTUAL Shared Observations with with Frame [%d|%d]:", OVO::FG_BLUE).c_str(), f->getId(), f->getKfId());
-        ROS_INFO("   KEYFRAME   | OBS NR");
-        for(std::map<FramePtr,int>::const_iterator it=kfObsCounterVO.begin(); it!=kfObsCounterVO.end(); ++it) {
-            ROS_INFO("   [%3d|%4d] | %3d/%3d (%3d)",it->first->getId(), it->first->getKfId(), it->second, kfObsCounter[it->first], it->first->getLandmarkRefNr());
         }
 
 
@@ -387,32 +404,39 @@ private:
         FramePtr kf = map.getLatestKF();
         double disparityTri = map.matchTriangulate(f, kf,matchesTri, matchesTriTime);
 
-        ROS_INFO("ODO = [%lu] potential candidates matched with [%f] disparity, triangulating", matchesTri.size(), disparityTri);
-        // triangulate
+        ROS_INFO("ODO = [%lu] potential candidates matched with [%f] disparity, %s", matchesTri.size(), disparityTri, seeds.isOn() ? "updating seeds" : "triangulating");
         Points3d points3d;
-        Bearings bvF;
-        Bearings bvKF;
-        OVO::alignedBV(f->getBearings(), kf->getBearings(), matchesTri, bvF, bvKF);
-        /// TODO: check baseline
-        triangulate(kf->getPose().inverse()*f->getPose(), bvKF, bvF, points3d);
-
-        // Reproject
-        ROS_INFO("ODO = Triangulated [%lu] potential points, checing reprojection error. Thresh [%f]", points3d.size(),voAbsRansacThresh );
-        Doubles error = OVO::reprojectErrPointsVsBV(points3d, bvKF, DMatches());
         DMatches matchesTriInlier;
-        Ints inliers;
-        for (uint i= 0; i<error.size(); ++i){
-            if (error[i]<voAbsRansacThresh){ /// TODO: own dynamic reconf var here
-                inliers.push_back(i);
+        if (seeds.isOn()){
+            // Only seeds whose depth converged become landmarks, no one shot triangulation
+            seeds.update(f, matchesTri);
+            seeds.getConverged(f, matchesTri, voAbsRansacThresh, matchesTriInlier, points3d);
+            ROS_INFO("ODO = Promoting [%lu/%lu] converged seeds to landmarks", matchesTriInlier.size(), matchesTri.size());
+        } else {
+            // triangulate
+            Bearings bvF;
+            Bearings bvKF;
+            OVO::alignedBV(f->getBearings(), kf->getBearings(), matchesTri, bvF, bvKF);
+            // Also checks cheirality, parallax and the reprojection error in both frames
+            Bools valid;
+            triangulate(kf->getPose().inverse()*f->getPose(), bvKF, bvF, points3d, valid, voAbsRansacThresh); /// TODO: own dynamic reconf var here
+            Ints inliers;
+            for (uint i= 0; i<valid.size(); ++i){
+                if (valid[i]){
+                    inliers.push_back(i);
+                }
             }
-        }
-        ROS_INFO("ODO = Successfully Projected [%lu/%lu] potential points", inliers.size(),points3d.size());
+            ROS_INFO("ODO = Successfully triangulated [%lu/%lu] potential points. Reprojection thresh [%f]", inliers.size(),points3d.size(), voAbsRansacThresh);
 
-        // Extract inliers
-        OVO::vecReduceInd(points3d, inliers);
-        OVO::vecReduceInd(matchesTri, matchesTriInlier, inliers);
-        OVO::transformPoints(kf->getPose(), points3d);
+            // Extract inliers
+            OVO::vecReduceInd(points3d, inliers);
+            OVO::vecReduceInd(matchesTri, matchesTriInlier, inliers);
+            OVO::transformPoints(kf->getPose(), points3d);
+        }
+        seeds.printStats();
         map.pushKFWithLandmarks(f, points3d, matchesTriInlier);
+        map.getCovisibility().printStats(f->getKfId());
+        seeds.reset(f);
 
         /// FOr every candidate keyframe, project map points and try to match. If successful, add observations
         /// Repeat with different keyframe pair
@@ -476,7 +500,9 @@ private:
 
 
         ros::WallTime t0 = ros::WallTime::now();
-        if (voAbsPoseMethod==0){            
+        // With the IMU we can always use the 2 point known rotation solver
+        const int absPoseMethod = (USE_IMU && voImuSolvers) ? 0 : voAbsPoseMethod;
+        if (absPoseMethod==0){            
             ROS_INFO("ODO = Using Relative Rotation Prior");
             ROS_ASSERT_MSG(USE_IMU, "Cannot use p2pIMU without IMU measurements!");
             /// Compute relative rotation using current and previous imu data
@@ -486,36 +512,82 @@ private:
         }
 
 
-        /// DO RANSAC
+        /// Try the motion model prediction first. If it already explains enough matches we dont need RANSAC
+        Pose transWtoF;
+        bool usedPrediction = false;
+        if (havePrediction){
+            transWtoF = posePredicted;
+            if (voPoseOpt){
+                // Refine the prediction over all matches, the robust kernel and inlier re-classification take care of outliers
+                if (!poseOpt.optimize(bvFMatched, worldPts, transWtoF, inliers, voAbsRansacThresh)){
+                    inliers.clear();
+                }
+            } else {
+                const Pose inversePrediction = posePredicted.inverse();
+                for (uint i=0; i<worldPts.size(); ++i){
+                    if (OVO::errorNormalisedBV(bvFMatched[i], (inversePrediction*worldPts[i]).normalized(), OVO::BVERR_OneMinusAdotB) < voAbsRansacThresh){
+                        inliers.push_back(i);
+                    }
+                }
+            }
+            const double ratio = static_cast<double>(inliers.size())/matches.size();
+            if (static_cast<int>(inliers.size())>=voMmMinInliers && ratio>=voMmMinRatio){
+                usedPrediction = true;
+                OVO::vecReduceInd<DMatches>(matches, matchesVO, inliers);
+                ROS_INFO("ODO = Predicted pose explains [%lu/%lu] matches, skipping RANSAC", inliers.size(), matches.size());
+            } else {
+                ROS_INFO("ODO = Predicted pose only explains [%lu/%lu] matches, doing RANSAC", inliers.size(), matches.size());
+                inliers.clear();
+            }
+        }
 
-        boost::shared_ptr<opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem>absposeproblem_ptr(
-                    new opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem(adapter,
-                        static_cast<opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem::Algorithm>(voAbsPoseMethod)) );
-        opengv::sac::Ransac<opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem> ransac;
-        ransac.sac_model_ = absposeproblem_ptr;
-        ransac.threshold_ = voAbsRansacThresh;
-        ransac.max_iterations_ = voAbsRansacIter;
 
-        ROS_INFO("ODO > Computing RANSAC absolute pose estimate over [%lu matches] with [threshold = %f] ", matches.size(), ransac.threshold_);
-        ransac.computeModel(1);
+        /// DO RANSAC
+        if (!usedPrediction){
+            boost::shared_ptr<opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem>absposeproblem_ptr(
+                        new opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem(adapter,
+                            static_cast<opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem::Algorithm>(absPoseMethod)) );
+            ParallelRansac<opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem> ransac;
+            ransac.sac_model_ = absposeproblem_ptr;
+            ransac.threshold_ = voAbsRansacThresh;
+            ransac.max_iterations_ = voAbsRansacIter;
+            setRansacOptions(ransac, matches);
+
+            ROS_INFO("ODO > Computing RANSAC absolute pose estimate over [%lu matches] with [threshold = %f] ", matches.size(), ransac.threshold_);
+            ransac.computeModel(1);
+            ROS_INFO("ODO < RANSAC bailed out early on [%d/%d] hypotheses", ransac.bailed_, ransac.iterations_);
 
 
-        // Set as output
-        Pose transWtoF;
-        transWtoF = ransac.model_coefficients_;
-        std::swap(inliers, ransac.inliers_);
-        OVO::vecReduceInd<DMatches>(matches, matchesVO, inliers);
+            // Set as output
+            transWtoF = ransac.model_coefficients_;
+            std::swap(inliers, ransac.inliers_);
+            OVO::vecReduceInd<DMatches>(matches, matchesVO, inliers);
 
 
-        if (inliers.size()<10){
-            ROS_WARN("ODO < RANSAC failed on Absolute Pose Estimation with %lu/%lu inliers [%d iterations] [%.1fms]", inliers.size(), matches.size(),  ransac.iterations_, (ros::WallTime::now()-t0).toSec()*1000.);
-            return false;
-        } else {
-            ROS_INFO("ODO < Absolute Ransac Done with %lu/%lu inliers [%d iterations] [%.1fms]", inliers.size(), matches.size(), ransac.iterations_,  (ros::WallTime::now()-t0).toSec()*1000.);
+            if (inliers.size()<10){
+                ROS_WARN("ODO < RANSAC failed on Absolute Pose Estimation with %lu/%lu inliers [%d iterations] [%.1fms]", inliers.size(), matches.size(),  ransac.iterations_, (ros::WallTime::now()-t0).toSec()*1000.);
+                return false;
+            } else {
+                ROS_INFO("ODO < Absolute Ransac Done with %lu/%lu inliers [%d iterations] [%.1fms]", inliers.size(), matches.size(), ransac.iterations_,  (ros::WallTime::now()-t0).toSec()*1000.);
+            }
         }
 
 
-        if (voAbsNLO){
+        if (voPoseOpt){
+            if (!usedPrediction){
+                // Refine over all matches so RANSAC outliers can come back. Already done for the prediction
+                Pose refined = transWtoF;
+                Ints inliersRefined;
+                if (poseOpt.optimize(bvFMatched, worldPts, refined, inliersRefined, voAbsRansacThresh)){
+                    ROS_INFO_STREAM("ODO = Pose refinement Difference:\n  " << (transWtoF.inverse()*refined).matrix());
+                    transWtoF = refined;
+                    std::swap(inliers, inliersRefined);
+                    OVO::vecReduceInd<DMatches>(matches, matchesVO, inliers);
+                } else {
+                    ROS_WARN("ODO = Pose refinement failed, keeping the RANSAC estimate");
+                }
+            }
+        } else if (voAbsNLO){
             ROS_INFO("ODO > Doing NLO on Absolute Pose");
             adapter.sett(transWtoF.translation());
             adapter.setR(transWtoF.linear());
@@ -528,6 +600,10 @@ private:
             transWtoF = opengv::absolute_pose::optimize_nonlinear(adapter, inliers) ;
             ROS_INFO("ODO < NLO Finished in [%.1fms]", (ros::WallTime::now()-tNLO).toSec()*1000);
             ROS_INFO_STREAM("ODO = NLO Difference:\n  " << (before.inverse()*transWtoF).matrix());
+        } else if (absPoseMethod==0 || usedPrediction){
+            // Keep the IMU / predicted rotation, refine the translation over all inliers
+            transWtoF.translation() = OVO::translationKnownRotationAbs(transWtoF.linear(), bvFMatched, worldPts, inliers);
+            ROS_INFO("ODO = Refined translation with known rotation over [%lu] inliers", inliers.size());
         }
 
 
@@ -616,7 +692,9 @@ private:
         Pose transKFtoF;
 
         ros::WallTime t0 = ros::WallTime::now();
-        if (voRelPoseMethod==4){
+        // With the IMU we can always use the 2 point known rotation solver
+        const bool knownRotation = voRelPoseMethod==4 || (USE_IMU && voImuSolvers);
+        if (knownRotation){
             /// Use IMU for rotation, compute translation
             ROS_INFO("Using IMU for relative rotation");
             // compute relative rotation
@@ -627,10 +705,11 @@ private:
 
             ///DO RANSAC for translation only
             boost::shared_ptr<RP::TranslationOnlySacProblem>relposeproblem_ptr(new RP::TranslationOnlySacProblem(adapter) );
-            opengv::sac::Ransac<RP::TranslationOnlySacProblem> ransac;
+            ParallelRansac<RP::TranslationOnlySacProblem> ransac;
             ransac.sac_model_ = relposeproblem_ptr;
             ransac.threshold_ = voRelRansacThresh;
             ransac.max_iterations_ = voRelRansacIter;
+            setRansacOptions(ransac, matches);
             ransac.computeModel(1);
 
             // Set as output
@@ -645,10 +724,11 @@ private:
                             static_cast<RP::CentralRelativePoseSacProblem::Algorithm>(voRelPoseMethod)) );
 
             // create a RANSAC object and run
-            opengv::sac::Ransac<RP::CentralRelativePoseSacProblem> ransac;
+            ParallelRansac<RP::CentralRelativePoseSacProblem> ransac;
             ransac.sac_model_ = relposeproblem_ptr;
             ransac.threshold_ = voRelRansacThresh;
             ransac.max_iterations_ = voRelRansacIter;
+            setRansacOptions(ransac, matches);
             ransac.computeModel(1);
 
             // set output
@@ -676,6 +756,15 @@ private:
             transKFtoF = opengv::relative_pose::optimize_nonlinear(adapter, inliers);
             ROS_INFO("ODO < NLO Finished in [%.1fms]", (ros::WallTime::now()-tNLO).toSec()*1000);
             ROS_INFO_STREAM("ODO = NLO Difference:\n  " << (before.inverse()*transKFtoF).matrix());            
+        } else if (knownRotation){
+            // Keep the IMU rotation, refine the translation direction over all inliers. Keep the scale and the side of the RANSAC solution
+            const Eigen::Vector3d t = transKFtoF.translation();
+            Eigen::Vector3d tRefined = OVO::translationKnownRotationRel(transKFtoF.linear(), bvKF, bvF, inliers) * t.norm();
+            if (tRefined.dot(t)<0){
+                tRefined = -tRefined;
+            }
+            transKFtoF.translation() = tRefined;
+            ROS_INFO("ODO = Refined translation with known rotation over [%lu] inliers", inliers.size());
         }
 
 
@@ -705,39 +794,27 @@ private:
         /// TRIANGULATE points in the keyframe frame
         ROS_INFO("ODO = Generating new point cloud. Relative Pose baseline [%f]", baselineInitial);
         double meanDepth=0.0;
+        Bools triValid;
         switch (voBaselineMethod){
             case BL_UNCHANGED:
                 ROS_INFO("ODO = Baseline left unchanged [%f]", baselineInitial);
-                triangulate(transKFtoF, bvKFinlier, bvFinlier, points3d);
+                triangulate(transKFtoF, bvKFinlier, bvFinlier, points3d, triValid, voRelRansacThresh);
                 break;
             case BL_FIXED:
                 ROS_INFO("ODO = Baseline scaled [1.0]");
                 transKFtoF.translation() *= 1.0/baselineInitial;
-                triangulate(transKFtoF, bvKFinlier, bvFinlier, points3d);
+                triangulate(transKFtoF, bvKFinlier, bvFinlier, points3d, triValid, voRelRansacThresh);
                 break;
             case BL_MANUAL_BASELINE:
                 ROS_INFO("ODO = Baseline selected scaled [%f]", voBaseline);
                 transKFtoF.translation() *= voBaseline/baselineInitial;
-                triangulate(transKFtoF, bvKFinlier, bvFinlier, points3d);
+                triangulate(transKFtoF, bvKFinlier, bvFinlier, points3d, triValid, voRelRansacThresh);
                 break;
             case BL_MANUAL_AVGDEPTH:
                 ROS_INFO("ODO > Scaling Baseline so avg depth is [%f]", voBaseline);
                 transKFtoF.translation() /= baselineInitial;
-                // Triangulate with baseline = 1
-                triangulate(transKFtoF, bvKFinlier, bvFinlier, points3d);
-                // calculate mean depth
-                for (uint i=0; i<points3d.size(); ++i){
-                   meanDepth += points3d[i].norm();
-                }
-                meanDepth /=static_cast<double>(points3d.size());
-                ROS_INFO("ODO = Baseline is [%f] with mean depth [%f]", baselineInitial, meanDepth);
-                // modify points
-                for (uint i=0; i<points3d.size(); ++i){
-                    points3d[i] /= meanDepth/voBaseline;
-                }
-                // modify baseline
-                transKFtoF.translation()/= meanDepth/voBaseline;
-                ROS_INFO("ODO < Baseline updated to [%f] with mean depth [%f]", transKFtoF.translation().norm(), voBaseline);
+                // Triangulate with baseline = 1, rescaled below once the invalid points are gone
+                triangulate(transKFtoF, bvKFinlier, bvFinlier, points3d, triValid, voRelRansacThresh);
                 break;
             case BL_AUTO_BASELINE:
                 ROS_INFO("ODO = Scaling baseline from ground truth");
@@ -760,11 +837,47 @@ private:
 
 
                 transKFtoF.translation()*= p.translation().norm()/baselineInitial;
-                triangulate(transKFtoF, bvKFinlier, bvFinlier, points3d);
+                triangulate(transKFtoF, bvKFinlier, bvFinlier, points3d, triValid, voRelRansacThresh);
                 break;
 
         }
 
+        /// Only keep points in front of both cameras with enough parallax and a small reprojection error
+        Ints triInliers;
+        for (uint i=0; i<triValid.size(); ++i){
+            if (triValid[i]){
+                triInliers.push_back(i);
+            }
+        }
+        ROS_INFO("ODO = Kept [%lu/%lu] valid triangulated points", triInliers.size(), points3d.size());
+        if (triInliers.size()<10){
+            ROS_WARN("ODO < Initialisation failed, only [%lu] valid triangulated points", triInliers.size());
+            return false;
+        }
+        OVO::vecReduceInd<Points3d>(points3d, triInliers);
+        OVO::vecReduceInd<Bearings>(bvKFinlier, triInliers);
+        OVO::vecReduceInd<DMatches>(matchesVO, triInliers);
+
+        if (voBaselineMethod==BL_MANUAL_AVGDEPTH){
+            // calculate mean depth of the valid points only, invalid ones may be near infinite or behind the camera
+            for (uint i=0; i<points3d.size(); ++i){
+               meanDepth += points3d[i].norm();
+            }
+            meanDepth /=static_cast<double>(points3d.size());
+            ROS_INFO("ODO = Baseline is [%f] with mean depth [%f]", baselineInitial, meanDepth);
+            if (!(meanDepth>0)){
+                ROS_WARN("ODO < Initialisation failed, invalid mean depth [%f]", meanDepth);
+                return false;
+            }
+            // modify points
+            for (uint i=0; i<points3d.size(); ++i){
+                points3d[i] /= meanDepth/voBaseline;
+            }
+            // modify baseline
+            transKFtoF.translation()/= meanDepth/voBaseline;
+            ROS_INFO("ODO < Baseline updated to [%f] with mean depth [%f]", transKFtoF.translation().norm(), voBaseline);
+        }
+
         // just for drawing really
         baselineCorrected = transKFtoF.translation().norm();
         meanDepth = 0;
@@ -793,6 +906,7 @@ private:
 
         /// Update map
         map.initialiseMap(f, points3d, matchesVO);
+        seeds.reset(f);
 
         ROS_INFO("ODO < Initialised");
         return true;
@@ -823,6 +937,11 @@ private:
         trackPoses.poses.clear();
         trackLines.points.clear();
         lostCounter = 0;
+        motion.reset();
+        havePrediction = false;
+        kltPrev = FramePtr();
+        kltPrevMatches.clear();
+        seeds.clear();
         ROS_INFO("ODO [M] < RESET");
     }
 
@@ -844,8 +963,8 @@ private:
     }
 
 
-    /// Computes 2d-2d matches vs latest KF
-    bool trackVO(FramePtr frame){
+    /// Computes 2d-2d matches vs latest KF. allowKlt = false forces descriptor matching
+    bool trackVO(FramePtr frame, const bool allowKlt=true){
         ROS_ASSERT(state==ST_WAIT_INIT || state == ST_TRACKING);
         // track against initial keyframe
         disparity = -1;
@@ -858,9 +977,27 @@ private:
             // TODO
         } else {
             // normal tracking against last keyframe
-            disparity = map.match2KF(frame, matches, timeMA, true);
-            // matches = ....
-            // TODO
+            bool tracked = false;
+            if (allowKlt && voKltTracking && !kltPrev.empty() && static_cast<int>(kltPrevMatches.size())>=voKltMinTracks){
+                // KLT from the last frame, no detection or descriptors
+                disparity = map.track2KF(frame, kltPrev, kltPrevMatches, matches, timeMA);
+                tracked = static_cast<int>(matches.size())>=voKltMinTracks;
+                if (!tracked){
+                    ROS_WARN("ODO [M] = Only [%lu] KLT tracks left, matching descriptors instead", matches.size());
+                    frame->clearAllPoints();
+                }
+            }
+            if (!tracked && havePrediction){
+                // tight gates around the landmarks projected into the predicted pose
+                disparity = map.match2KFPredicted(frame, posePredicted, matches, timeMA);
+                if (static_cast<int>(matches.size())<voMmMinInliers){
+                    ROS_WARN("ODO [M] = Only [%lu] matches with the predicted pose, matching without it", matches.size());
+                    havePrediction = false;
+                }
+            }
+            if (!tracked && !havePrediction){
+                disparity = map.match2KF(frame, matches, timeMA, true);
+            }
         }
 
         if (disparity>=0){
@@ -923,6 +1060,40 @@ private:
     }
 
 
+    /// A KLT tracked frame only has the tracked keypoints. Before it can become a KF it needs all keypoints and descriptors,
+    /// so we detect, match and estimate the pose again, using the pose we already have as prediction
+    bool redetectVO(FramePtr frame){
+        ROS_INFO("ODO [M] > REDETECTING KLT TRACKED FRAME [%d]", frame->getId());
+        ros::WallTime t0 = ros::WallTime::now();
+        frame->clearAllPoints();
+        posePredicted = frame->getPose();
+        havePrediction = true;
+        if (trackVO(frame, false) && estimatePoseVO(frame)){
+            ROS_INFO("ODO [M] < REDETECTION SUCCESS [%.1fms]", 1000.*(ros::WallTime::now()-t0).toSec());
+            return true;
+        } else {
+            // dont leave matches into keypoints that no longer exist
+            matchesVO.clear();
+            ROS_WARN("ODO [M] < REDETECTION FAIL [%.1fms]", 1000.*(ros::WallTime::now()-t0).toSec());
+            return false;
+        }
+    }
+
+
+    /// Refines the depth filter seeds of the latest KF with their matches in frame, which must have a pose
+    void updateSeedsVO(FramePtr frame){
+        if (seeds.getSeedNr()==0){
+            return;
+        }
+        ros::WallTime t0 = ros::WallTime::now();
+        DMatches seedMatches;
+        double t;
+        map.match2KFBearings(frame, seeds.predict(frame), seeds.getSeedKps(), seedMatches, t);
+        seeds.update(frame, seedMatches);
+        ROS_INFO("ODO [M] = Seeds updated [%.1fms]", (ros::WallTime::now()-t0).toSec()*1000.);
+    }
+
+
     /// Try to relocate against the map. Computes 2d-3d matches. Does absolutePose. Adds Kf. Updates Map
     bool relocateVO(FramePtr frame){
         ROS_INFO("ODO [M] > DOING RELOCALISATION");
@@ -1013,6 +1184,10 @@ private:
 
         /// Add KF, Triangulate, initialise Map?
         if (control == CTR_DO_ADDKF || disparity >= voInitDisparity){
+            if (!kfAllowed){
+                ROS_WARN("ODO [H] < Initialisation deferred: no time budget [Disparity = %f/%f]", disparity, voInitDisparity);
+                return;
+            }
             control = CTR_DO_NOTHING;
             ROS_INFO(OVO::colorise("ODO [H] > Initialising [Disparity = %f/%f]",OVO::FG_MAGNETA).c_str(), disparity, voInitDisparity);
             if (initialiseVO(frame)){
@@ -1052,6 +1227,9 @@ private:
         }
 
 
+        /// Predict where we are
+        havePrediction = motion.predict(frame, posePredicted);
+
         /// Do tracking vs last keyframe
         if (!trackVO(frame)) {
             // Failed to track
@@ -1084,9 +1262,19 @@ private:
 
         /// Add KF and and update Map
         if (control == CTR_DO_ADDKF || disparity >= voKfDisparity){
+            if (!kfAllowed){
+                // Keep any user control for the next frame that may add a KF
+                ROS_WARN("ODO [H] < Tracking Success, KF deferred: no time budget [Disparity = %f/%f]", disparity, voKfDisparity);
+                return;
+            }
             control = CTR_DO_NOTHING;
             ROS_INFO("ODO [H] > Adding KF [Disparity = %f/%f", disparity, voKfDisparity);
 
+            if (frame->isTracked() && !redetectVO(frame)){
+                ROS_WARN("ODO [H] < Tracking Success, but failed to redetect the KLT tracked frame for the KF");
+                return;
+            }
+
             if (addKf(frame)){
                 // Successfully added KF
                 ROS_INFO("ODO [H] < KF added");
@@ -1098,6 +1286,9 @@ private:
                 ROS_WARN("ODO [H] < Tracking fail: Matching okay but KF could not be added");
                 return;
             }
+        } else if (seeds.isOn() && !frame->isTracked()){
+            // KLT tracked frames only have the landmark keypoints, nothing to match the seeds against
+            updateSeedsVO(frame);
         }
         ROS_WARN("ODO [H] < Tracking Success");
     }
@@ -1153,6 +1344,8 @@ public:
         control = CTR_DO_NOTHING;
         state   = ST_WAIT_FIRST_FRAME;
         disparity = -1;
+        kfAllowed = true;
+        havePrediction = false;
         matchesVO.clear();
         matches.clear();
 
@@ -1167,9 +1360,19 @@ public:
         voRelRansacThresh = 4;
         voRelPoseMethod = 0;
         voTriangulationMethod = 1;
+        voTriMinParallax = 0.5;
         voInitDisparity = 40;
         voAbsPoseMethod = 1;
         voAbsRansacIter = 800;
+        voRansacThreads = 0;
+        voRansacProsac = true;
+        voRansacSprt = true;
+        voImuSolvers = false;
+        voMmMinInliers = 30;
+        voMmMinRatio = 0.7;
+        voKltTracking = false;
+        voKltMinTracks = 50;
+        voPoseOpt = true;
         voAbsRansacThresh = 4;
         frameQualityThreshold = 0.2;
         keyFrameQualityThreshold = 0.6;
@@ -1197,8 +1400,23 @@ public:
 
 
     // a step in the VO pipeline. Main entry point for odometry
-    void update(FramePtr frame){
-        ROS_INFO("ODO > PROCESSING FRAME [%d] - Current in state [%s]", frame->getId(), getStateName().c_str());
+    // If allowKf = false we only track, no keyframes, initialisation or BA. Used when we are short on time.
+    void update(FramePtr frame, const bool allowKf=true){
+        ROS_INFO("ODO > PROCESSING FRAME [%d] - Current in state [%s]%s", frame->getId(), getStateName().c_str(), allowKf ? "" : " [TRACK ONLY]");
+        kfAllowed = allowKf;
+        havePrediction = false;
+
+        // Pick up the results of a background BA before we use the map. Poses estimated against the old map follow the
+        // correction, keyframes among them were already moved by the map
+        Pose correction;
+        if (map.collectBA(correction)){
+            ROS_INFO("ODO = Map updated by background BA");
+            motion.applyCorrection(correction);
+            if (!kltPrev.empty() && kltPrev->getKfId()<0 && kltPrev->poseEstimated()){
+                Pose pose = correction * kltPrev->getPose();
+                kltPrev->setPose(pose);
+            }
+        }
 
         /// Skip frame immediatly if quality is too bad (should ust be used for extremely bad frames)
         /// Currently handled else where
@@ -1234,6 +1452,23 @@ public:
             geometry_msgs::Pose pm = frame->getPoseMarker(false, true);
             trackPoses.poses.push_back(pm);
             trackLines.points.push_back(pm.position);
+            motion.update(frame);
+        }
+
+        // Reference for KLT tracking the next frame
+        if (state==ST_TRACKING){
+            if (frame->getKfId()>=0){
+                const Ints lms = frame->getIndLM();
+                kltPrevMatches.clear();
+                kltPrevMatches.reserve(lms.size());
+                for (uint i=0; i<lms.size(); ++i){
+                    kltPrevMatches.push_back(cv::DMatch(lms[i], lms[i], 0.f));
+                }
+                kltPrev = frame;
+            } else if (frame->poseEstimated() && !matchesVO.empty()){
+                kltPrevMatches = matchesVO;
+                kltPrev = frame;
+            }
         }
 
         ROS_INFO("ODO < PROCESSED FRAME [%d]", frame->getId());
@@ -1275,6 +1510,10 @@ public:
 
         OVO::putInt(image, map.getKeyframeNr(), cv::Point2f(image.cols-95,6*25), CV_RGB(120,80,255), true,  "KFS:");
         OVO::putInt(image, map.getLandmarkNr(), cv::Point2f(image.cols-95,7*25), CV_RGB(120,80,255), true,  "LMS:");
+        if (map.getBAScheduler().isOn()){
+            OVO::putInt(image, map.getBAScheduler().getLocalNr(), cv::Point2f(image.cols-95,8*25), map.getBAScheduler().getDecision()==BAScheduler::BA_LOCAL ? CV_RGB(200,0,0) : CV_RGB(120,80,255), true,  "LBA:");
+            OVO::putInt(image, map.getBAScheduler().getGlobalNr(), cv::Point2f(image.cols-95,9*25), map.getBAScheduler().getDecision()==BAScheduler::BA_GLOBAL ? CV_RGB(200,0,0) : CV_RGB(120,80,255), true,  "GBA:");
+        }
 
         if (lostCounter>0){
             OVO::putInt(image, static_cast<float>(lostCounter)/lostThresh*100.f, cv::Point2f(image.cols/2-95,8*25), OVO::getColor(-lostCounter*2,lostThresh, lostCounter), true,  "LOST:","%");
@@ -1414,11 +1653,24 @@ public:
 
 
         voTriangulationMethod = config.vo_triMethod;
+        voTriMinParallax      = config.vo_triMinParallax;
         voRelNLO          = config.vo_relNLO;        
         voBaselineMethod  = static_cast<BaselineMethod>(config.vo_relBaselineMethod);
         voBaseline        = config.vo_relBaseline;
         voAbsRansacIter   = config.vo_absRansacIter;        
+        voRansacThreads   = config.vo_ransacThreads;
+        voRansacProsac    = config.vo_ransacProsac;
+        voRansacSprt      = config.vo_ransacSprt;
+        voImuSolvers      = config.vo_imuSolvers;
+        voMmMinInliers    = config.vo_mmMinInliers;
+        voMmMinRatio      = config.vo_mmMinRatio;
+        voKltTracking     = config.vo_kltTracking;
+        voKltMinTracks    = config.vo_kltMinTracks;
+        motion.setParameter(config, level);
         voAbsNLO          = config.vo_absNLO;
+        voPoseOpt         = config.vo_poseOpt;
+        poseOpt.setParameter(config, level);
+        seeds.setParameter(config, level);
 
 
         voRelRansacThresh = OVO::px2error(config.vo_relRansacThresh); //1.0 - cos(atan(config.vo_relRansacThresh*sqrt(2.0)*0.5/720.0));
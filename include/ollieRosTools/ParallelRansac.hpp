@@ -0,0 +1,398 @@
+#ifndef PARALLELRANSAC_HPP
+#define PARALLELRANSAC_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <limits>
+#include <boost/shared_ptr.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int.hpp>
+#include <boost/random/variate_generator.hpp>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+
+/// Multi threaded drop in replacement for opengv::sac::Ransac, works with any opengv SampleConsensusProblem.
+/// Same interface: set sac_model_, threshold_, max_iterations_, call computeModel(), read model_coefficients_, inliers_, iterations_.
+///  - Hypotheses are generated and scored in parallel, each thread has its own random number generator.
+///    The problem is only accessed through its const functions while running in parallel.
+///  - Hypotheses are scored preemptively on blocks of a random permutation of the data and bail out early
+///    if they can no longer beat the best model or are statistically worse than it (Capel, "An Effective Bail-out Test for RANSAC Consensus Scoring")
+///  - Alternatively hypotheses are verified with Wald's SPRT (Matas and Chum, "Randomized RANSAC with Sequential Probability Ratio Test")
+///  - If prosac_order_ is set, minimal sets are drawn progressively from the best correspondences first
+///    (Chum and Matas, "Matching with PROSAC - Progressive Sample Consensus"). In parallel each iteration number
+///    still maps to exactly one PROSAC sampling pool size
+///  - The number of iterations adapts to the inlier ratio of the best model found so far, as in opengv
+template<typename PROBLEM_T>
+class ParallelRansac {
+public:
+    typedef PROBLEM_T problem_t;
+    typedef typename problem_t::model_t model_t;
+
+    ParallelRansac(int maxIterations = 1000, double threshold = 1.0, double probability = 0.99):
+        probability_(probability),
+        threshold_(threshold),
+        max_iterations_(maxIterations),
+        iterations_(0),
+        threads_(0),
+        block_size_(16),
+        bail_sigma_(3.0),
+        sprt_(false),
+        sprt_delta_(0.05),
+        sprt_model_cost_(200),
+        bailed_(0){
+        seed_ = static_cast<unsigned int>(std::time(0)) ^ static_cast<unsigned int>(std::clock());
+    }
+
+    /// Problem we are solving
+    boost::shared_ptr<PROBLEM_T> sac_model_;
+    /// Indices of the minimal set of the best model
+    std::vector<int> model_;
+    /// Inliers of the best model
+    std::vector<int> inliers_;
+    /// Best model
+    model_t model_coefficients_;
+    /// Desired probability of having drawn at least one outlier free sample
+    double probability_;
+    /// Inlier threshold, same units as the problem distances
+    double threshold_;
+    /// Upper limit of hypotheses
+    int max_iterations_;
+    /// Hypotheses evaluated during the last computeModel
+    int iterations_;
+    /// Number of threads, <=0 uses all cores
+    int threads_;
+    /// Number of correspondences scored per preemption step
+    int block_size_;
+    /// A hypothesis is dropped once its inlier ratio is this many std devs below the best one. <=0 only bails when it cannot win anymore
+    double bail_sigma_;
+    /// Use SPRT instead of the bail-out test
+    bool sprt_;
+    /// SPRT: initial probability of a correspondence being consistent with a bad model, adapted while running
+    double sprt_delta_;
+    /// SPRT: time to compute a hypothesis in units of single correspondence evaluations
+    double sprt_model_cost_;
+    /// PROSAC: sac indices sorted by quality, best first. Leave empty for uniform sampling
+    std::vector<int> prosac_order_;
+    /// Hypotheses dropped early during the last computeModel
+    int bailed_;
+    /// Seed, each thread uses seed_+threadNr
+    unsigned int seed_;
+
+
+    bool computeModel(int /*debug_verbosity_level*/ = 0){
+        model_.clear();
+        inliers_.clear();
+        iterations_ = 0;
+        bailed_ = 0;
+
+        const std::vector<int>& indices = *sac_model_->getIndices();
+        const int n = static_cast<int>(indices.size());
+        const int s = sac_model_->getSampleSize();
+        if (n<s || max_iterations_<=0){
+            return false;
+        }
+
+        // Score hypotheses in a random order, so every block is an unbiased subset
+        std::vector<int> order(indices);
+        boost::mt19937 rngOrder(seed_);
+        for (int i=n-1; i>0; --i){
+            boost::uniform_int<> dist(0, i);
+            std::swap(order[i], order[dist(rngOrder)]);
+        }
+
+        // PROSAC sampling pool size for each iteration
+        const bool prosac = static_cast<int>(prosac_order_.size())==n;
+        std::vector<int> pool, poolLeft;
+        if (prosac){
+            computeProsacPool(n, s, pool, poolLeft);
+        }
+
+        // Shared state. Read without locking by all threads, only written inside the critical section
+        volatile int bestCount = 0;
+        volatile int maxIter   = max_iterations_;
+        int started  = 0;
+        int finished = 0;
+        int bailed   = 0;
+        int skipped  = 0;
+        const int maxSkip = max_iterations_*10;
+        const int block = std::max(1, block_size_);
+        Sprt sprt;
+        sprt.delta = sprt_delta_;
+
+        #ifdef _OPENMP
+        const int threads = threads_>0 ? threads_ : omp_get_max_threads();
+        #pragma omp parallel num_threads(threads)
+        #endif
+        {
+            #ifdef _OPENMP
+            boost::mt19937 rng(seed_ + 1 + omp_get_thread_num());
+            #else
+            boost::mt19937 rng(seed_ + 1);
+            #endif
+
+            std::vector<int> sample(s);
+            std::vector<int> subset;
+            std::vector<double> distances;
+            model_t model;
+            Sprt sprtLocal;
+
+            while (true){
+                // Claim the next hypothesis
+                const int it = __sync_fetch_and_add(&started, 1);
+                if (it >= maxIter || skipped > maxSkip){
+                    break;
+                }
+
+                // Draw a minimal set without repetitions
+                if (prosac && pool[it]<n){
+                    // Newest member of the pool plus s-1 from the better ones
+                    sample[0] = prosac_order_[pool[it]-1];
+                    drawSample(rng, prosac_order_, pool[it]-1, 1, sample);
+                } else if (prosac){
+                    drawSample(rng, prosac_order_, n, 0, sample);
+                } else {
+                    drawSample(rng, indices, n, 0, sample);
+                }
+
+                if (!sac_model_->isSampleGood(sample) || !sac_model_->computeModelCoefficients(sample, model)){
+                    __sync_fetch_and_add(&skipped, 1);
+                    __sync_fetch_and_sub(&started, 1);
+                    continue;
+                }
+
+                if (sprt_){
+                    #ifdef _OPENMP
+                    #pragma omp critical(ParallelRansacSprt)
+                    #endif
+                    sprtLocal = sprt;
+                }
+
+                // Preemptive scoring
+                int count = 0;
+                int evaluated = 0;
+                bool bail = false;
+                bool sprtRejected = false; // bailed by the SPRT itself, not because it could not win anymore
+                double lambda = 1.0;
+                while (evaluated<n && !bail){
+                    const int end = std::min(n, evaluated+block);
+                    subset.assign(order.begin()+evaluated, order.begin()+end);
+                    sac_model_->getSelectedDistancesToModel(model, subset, distances);
+                    for (uint i=0; i<distances.size(); ++i){
+                        const bool consistent = distances[i] < threshold_;
+                        if (consistent){
+                            ++count;
+                        }
+                        // SPRT: likelihood ratio of the model being bad vs good
+                        if (sprtLocal.active()){
+                            lambda *= consistent ? sprtLocal.delta/sprtLocal.eps : (1.0-sprtLocal.delta)/(1.0-sprtLocal.eps);
+                            if (lambda > sprtLocal.A){
+                                evaluated += i+1;
+                                bail = true;
+                                sprtRejected = true;
+                                break;
+                            }
+                        }
+                    }
+                    if (bail){
+                        break;
+                    }
+                    evaluated = end;
+                    if (evaluated==n){
+                        break;
+                    }
+
+                    const int best = bestCount;
+                    // Cannot win anymore
+                    if (count + n - evaluated <= best){
+                        bail = true;
+                        break;
+                    }
+                    // Bail-out test: inlier ratio so far significantly below that of the best model
+                    if (!sprt_ && bail_sigma_>0 && best>0){
+                        const double eps = static_cast<double>(best)/n;
+                        const double sigma = std::sqrt(eps*(1.0-eps)/evaluated);
+                        if (static_cast<double>(count)/evaluated < eps - bail_sigma_*sigma){
+                            bail = true;
+                            break;
+                        }
+                    }
+                }
+                __sync_fetch_and_add(&finished, 1);
+
+                if (bail){
+                    __sync_fetch_and_add(&bailed, 1);
+                    if (sprtRejected){
+                        // Models the SPRT rejected are assumed bad, use them to estimate delta. Ones that merely could not
+                        // beat the best model can still be good and would bias it
+                        #ifdef _OPENMP
+                        #pragma omp critical(ParallelRansacSprt)
+                        #endif
+                        sprt.updateDelta(static_cast<double>(count)/std::max(1, evaluated), sprt_model_cost_);
+                    }
+                    continue;
+                }
+
+                if (count>bestCount){
+                    #ifdef _OPENMP
+                    #pragma omp critical(ParallelRansacBest)
+                    #endif
+                    {
+                        if (count>bestCount){
+                            bestCount = count;
+                            model_ = sample;
+                            model_coefficients_ = model;
+
+                            // Adapt the number of iterations to the new inlier ratio
+                            const double w = static_cast<double>(count)/n;
+                            double pNoOutliers = 1.0 - std::pow(w, static_cast<double>(s));
+                            pNoOutliers = std::max(std::numeric_limits<double>::epsilon(), pNoOutliers);
+                            pNoOutliers = std::min(1.0 - std::numeric_limits<double>::epsilon(), pNoOutliers);
+                            const double k = std::log(1.0 - probability_) / std::log(pNoOutliers);
+                            int kMin = static_cast<int>(std::min(static_cast<double>(max_iterations_), std::ceil(k)));
+                            if (prosac){
+                                double delta;
+                                #ifdef _OPENMP
+                                #pragma omp critical(ParallelRansacSprt)
+                                #endif
+                                delta = sprt.delta;
+                                kMin = std::min(kMin, prosacStop(model, s, poolLeft, delta));
+                            }
+                            maxIter = kMin;
+
+                            if (sprt_){
+                                #ifdef _OPENMP
+                                #pragma omp critical(ParallelRansacSprt)
+                                #endif
+                                sprt.updateEps(w, sprt_model_cost_);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        iterations_ = finished;
+        bailed_     = bailed;
+
+        if (model_.empty()){
+            return false;
+        }
+
+        sac_model_->selectWithinDistance(model_coefficients_, threshold_, inliers_);
+        return true;
+    }
+
+
+private:
+    /// PROSAC never stops based on fewer than this many of the best correspondences
+    static const int PROSAC_MIN_POOL = 20;
+
+    /// SPRT state: eps = inlier ratio of the best model, delta = consistency of bad models, A = decision threshold
+    struct Sprt {
+        double eps;
+        double delta;
+        double A;
+        Sprt(): eps(0), delta(0.05), A(std::numeric_limits<double>::max()){}
+
+        bool active() const {
+            return eps>delta;
+        }
+        void updateEps(const double e, const double modelCost){
+            eps = e;
+            updateA(modelCost);
+        }
+        void updateDelta(const double d, const double modelCost){
+            delta = std::min(0.5, std::max(0.001, 0.9*delta + 0.1*d));
+            updateA(modelCost);
+        }
+        // Decision threshold A from A = tM*C + 1 + log(A), Matas and Chum eq. 14
+        void updateA(const double modelCost){
+            if (!active()){
+                return;
+            }
+            const double C = (1.0-delta)*std::log((1.0-delta)/(1.0-eps)) + delta*std::log(delta/eps);
+            const double A0 = modelCost*C + 1.0;
+            A = A0;
+            for (int i=0; i<10; ++i){
+                A = A0 + std::log(A);
+            }
+        }
+    };
+
+    /// Fills sample[from..] with unique elements drawn from the first nr entries of data
+    static void drawSample(boost::mt19937& rng, const std::vector<int>& data, const int nr, const int from, std::vector<int>& sample){
+        boost::uniform_int<> dist(0, nr-1);
+        for (uint i=from; i<sample.size(); ++i){
+            bool unique;
+            do {
+                sample[i] = data[dist(rng)];
+                unique = std::find(sample.begin(), sample.begin()+i, sample[i]) == sample.begin()+i;
+            } while (!unique);
+        }
+    }
+
+    /// PROSAC growth function. pool[t] = how many of the best correspondences iteration t samples from
+    /// poolLeft[m] = first iteration that samples from outside the best m, ie how many samples come from the best m only
+    void computeProsacPool(const int n, const int s, std::vector<int>& pool, std::vector<int>& poolLeft) const {
+        pool.resize(max_iterations_, n);
+        poolLeft.assign(n+1, max_iterations_);
+        // T_N = 200000 as in the paper, Tn = expected nr of samples drawn from the first n only
+        double Tn = 200000;
+        for (int i=0; i<s; ++i){
+            Tn *= static_cast<double>(s-i)/(n-i);
+        }
+        int size = s;
+        double TnPrime = 1;
+        for (int t=0; t<max_iterations_; ++t){
+            while (t+1 > TnPrime && size<n){
+                const double TnNext = Tn*(size+1)/(size+1-s);
+                TnPrime += std::ceil(TnNext-Tn);
+                Tn = TnNext;
+                ++size;
+            }
+            pool[t] = size;
+        }
+        for (int t=max_iterations_-1; t>=0; --t){
+            for (int m=s; m<pool[t]; ++m){
+                poolLeft[m] = t;
+            }
+        }
+    }
+
+    /// PROSAC stopping criterion. Finds the smallest number of iterations after which, for some pool of the best m correspondences,
+    /// enough samples were drawn from within that pool to have found an outlier free one given the inlier ratio of the model in that pool.
+    /// The inliers within the pool must also be unlikely to be random, given delta = the chance a random correspondence is consistent.
+    int prosacStop(const model_t& model, const int s, const std::vector<int>& poolLeft, const double delta) const {
+        std::vector<double> distances;
+        sac_model_->getSelectedDistancesToModel(model, prosac_order_, distances);
+        int kMin = max_iterations_;
+        int inliers = 0;
+        for (int m=1; m<=static_cast<int>(distances.size()); ++m){
+            if (distances[m-1] < threshold_){
+                ++inliers;
+            }
+            // Too few correspondences to say anything
+            if (m<PROSAC_MIN_POOL || inliers<=s){
+                continue;
+            }
+            // Non-randomness, three sigma above what a random model would get
+            if (inliers < s + delta*(m-s) + 3.0*std::sqrt(delta*(1.0-delta)*(m-s))){
+                continue;
+            }
+            const double pNoOutliers = std::min(1.0 - std::numeric_limits<double>::epsilon(), 1.0 - std::pow(static_cast<double>(inliers)/m, s));
+            const int k = static_cast<int>(std::ceil(std::log(1.0 - probability_) / std::log(pNoOutliers)));
+            if (k <= poolLeft[m]){
+                kMin = std::min(kMin, k);
+            }
+        }
+        return kMin;
+    }
+
+};
+
+#endif // PARALLELRANSAC_HPP
@@ -0,0 +1,68 @@
+#ifndef POSEGRAPH_HPP
+#define POSEGRAPH_HPP
+
+#include <map>
+#include <utility>
+
+#include <Eigen/StdVector>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include <ros/ros.h>
+
+#include <ollieRosTools/custom_types/edge_pose_pose.hpp>
+#include <ollieRosTools/custom_types/vertex_pose.hpp>
+
+#include <ollieRosTools/VoNode_paramsConfig.h>
+#include <ollieRosTools/BundleAdjuster.hpp>
+#include <ollieRosTools/aux.hpp>
+
+
+
+/// Relative pose constraints between keyframes (consecutive and covisible ones), measured by BA and weighted with the
+/// information of its marginals. Optimising only the keyframe poses over them (EdgePosePose) keeps keyframes outside the
+/// local BA window consistent with it at a fraction of the cost of a global BA.
+/// The edges persist between runs; a fresh small g2o graph is built for every optimisation.
+class PoseGraph {
+public:
+    typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+    typedef std::vector<BAProblem::KF, Eigen::aligned_allocator<BAProblem::KF> > KFs;
+
+    PoseGraph();
+
+    // Adds or replaces the edge a -> b. relative = Ta^-1 * Tb, information in EdgePosePose error coordinates
+    void setEdge(const int a, const int b, const Pose& relative, const Matrix6d& information);
+
+    // Information of the relative pose of b in a in EdgePosePose error coordinates, given their joint marginal covariance in
+    // the right perturbation (translation, rotation) coordinates of each pose. Cab = cov(a, b)
+    static Matrix6d relativeInformation(const Pose& Ta, const Pose& Tb, const Matrix6d& Caa, const Matrix6d& Cbb, const Matrix6d& Cab);
+
+    // Removes keyframe kfId and its edges. If it linked prev and next and they have no edge yet they get the composed one
+    void removeKF(const int kfId, const int prevId=-1, const int nextId=-1);
+
+    // Optimises the free keyframes of kfs over the edges between keyframes in kfs. Returns the iterations done, 0 if there was nothing to do
+    int optimize(KFs& kfs);
+
+    void reset();
+
+    uint getEdgeNr() const {return edges.size();}
+
+    void setParameter(ollieRosTools::VoNode_paramsConfig &config, uint32_t level);
+
+private:
+    struct Edge {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        Pose relative;
+        Matrix6d information;
+    };
+    typedef std::pair<int, int> EdgeKey; // kfId a < kfId b
+    typedef std::map<EdgeKey, Edge, std::less<EdgeKey>, Eigen::aligned_allocator<std::pair<const EdgeKey, Edge> > > EdgeMap;
+
+    // Edge a -> b in that direction, false if there is none
+    bool getEdge(const int a, const int b, Edge& e) const;
+
+    EdgeMap edges;
+    int iterations;
+};
+
+#endif // POSEGRAPH_HPP
@@ -0,0 +1,158 @@
+#ifndef POSEOPTIMIZER_HPP
+#define POSEOPTIMIZER_HPP
+
+#include <vector>
+#include <cmath>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
+#include <ros/ros.h>
+#include <ollieRosTools/VoNode_paramsConfig.h>
+#include <ollieRosTools/aux.hpp>
+#include <ollieRosTools/custom_types/math_functions.hpp>
+
+
+
+/// Motion only pose refinement: the 6 DoF pose of a camera against fixed world points observed as bearing vectors.
+/// The residual of each observation is the predicted bearing expressed in a 2d tangent basis of the measured bearing,
+/// which works for any field of view. Everything is fixed size (2x6 jacobians, 6x6 normal equations), so an iteration
+/// over a few hundred points takes microseconds.
+/// Robustness comes from iteratively reweighted least squares (Huber or Cauchy, with the inlier threshold as kernel width)
+/// and from re-classifying inliers between rounds, as in ORB-SLAM: each round only uses the inliers of the previous one,
+/// but outliers are re-evaluated after every round and can come back.
+class PoseOptimizer {
+public:
+    enum Kernel {KERNEL_NONE, KERNEL_HUBER, KERNEL_CAUCHY};
+
+    PoseOptimizer():
+        kernel(KERNEL_HUBER),
+        rounds(4),
+        iterations(10),
+        minInliers(10){
+    }
+
+    /// Refines pose (camera -> world) so bv[i] observes points[i]. thresh is a 1-cos(angle) bearing error as used by RANSAC.
+    /// Inliers returns the indices of the final inliers. Returns false and leaves the pose untouched if too few are left
+    bool optimize(const Bearings& bv, const Points3d& points, Pose& pose, Ints& inliers, const double thresh) const {
+        ROS_ASSERT(bv.size()==points.size());
+        ros::WallTime t0 = ros::WallTime::now();
+        const uint n = bv.size();
+        inliers.clear();
+
+        // 1-cos(a) -> sin(a), the length of the tangent residual at the threshold
+        const double k2 = OVO::error2tangentSq(thresh);
+
+        // Tangent basis of each measured bearing, its rows are orthogonal to it
+        std::vector<Eigen::Matrix<double, 2, 3>, Eigen::aligned_allocator<Eigen::Matrix<double, 2, 3> > > basis(n);
+        for (uint i=0; i<n; ++i){
+            basis[i] = OVO::tangentBasis(bv[i].normalized());
+        }
+
+        Eigen::Matrix3d R = pose.linear();
+        Eigen::Vector3d t = pose.translation();
+        Bools inlier(n, true);
+        uint nrInliers = n;
+        int iter = 0;
+        double chi2 = 0;
+
+        for (int r=0; r<rounds; ++r){
+            for (int it=0; it<iterations; ++it, ++iter){
+                Eigen::Matrix<double, 6, 6> H = Eigen::Matrix<double, 6, 6>::Zero();
+                Eigen::Matrix<double, 6, 1> g = Eigen::Matrix<double, 6, 1>::Zero();
+                const Eigen::Matrix3d Rt = R.transpose();
+                chi2 = 0;
+
+                for (uint i=0; i<n; ++i){
+                    if (!inlier[i]){
+                        continue;
+                    }
+                    const Eigen::Vector3d P = Rt*(points[i]-t);
+                    const double norm = P.norm();
+                    if (norm<1e-9){
+                        continue;
+                    }
+                    const Eigen::Vector3d u = P/norm;
+                    const Eigen::Vector2d e = basis[i]*u;
+                    const double e2 = e.squaredNorm();
+                    const double w = weight(e2, k2);
+
+                    // d(u)/d(P) projected onto the tangent plane. The increment is applied on the right:
+                    // t += R*dt, R = R*exp(dw) => P -= dt + dw x P
+                    const Eigen::Matrix<double, 2, 3> Ju = basis[i]*(Eigen::Matrix3d::Identity()-u*u.transpose())/norm;
+                    Eigen::Matrix<double, 2, 6> J;
+                    J.leftCols<3>()  = -Ju;
+                    J.rightCols<3>() = Ju*skew(P);
+
+                    H.noalias() += w*J.transpose()*J;
+                    g.noalias() += w*J.transpose()*e;
+                    chi2 += w*e2;
+                }
+
+                const Eigen::LDLT<Eigen::Matrix<double, 6, 6> > ldlt(H);
+                if (ldlt.info()!=Eigen::Success || H.diagonal().minCoeff()<1e-12){
+                    ROS_WARN("POS = Degenerate normal equations after [%d] iterations", iter);
+                    return false;
+                }
+                const Eigen::Matrix<double, 6, 1> delta = -ldlt.solve(g);
+
+                t += R*delta.head<3>();
+                const double angle = delta.tail<3>().norm();
+                if (angle>1e-12){
+                    R = R*Eigen::AngleAxisd(angle, delta.tail<3>()/angle).toRotationMatrix();
+                }
+
+                if (delta.squaredNorm()<1e-14){
+                    ++iter;
+                    break;
+                }
+            }
+
+            // Re-classify all observations, including previous outliers
+            nrInliers = 0;
+            const Eigen::Matrix3d Rt = R.transpose();
+            for (uint i=0; i<n; ++i){
+                const Eigen::Vector3d u = (Rt*(points[i]-t)).normalized();
+                inlier[i] = u.dot(bv[i].normalized())>0 && (basis[i]*u).squaredNorm()<k2;
+                nrInliers += inlier[i];
+            }
+            if (static_cast<int>(nrInliers)<minInliers){
+                ROS_WARN("POS = Only [%u/%u] inliers left after round [%d/%d] [%.3fms]", nrInliers, n, r+1, rounds, (ros::WallTime::now()-t0).toSec()*1000.);
+                return false;
+            }
+        }
+
+        inliers.reserve(nrInliers);
+        for (uint i=0; i<n; ++i){
+            if (inlier[i]){
+                inliers.push_back(i);
+            }
+        }
+        pose.linear() = R;
+        pose.translation() = t;
+        ROS_INFO("POS = Refined pose over [%u/%u] inliers in [%d] iterations, chi2 [%g] [%.3fms]", nrInliers, n, iter, chi2, (ros::WallTime::now()-t0).toSec()*1000.);
+        return true;
+    }
+
+    void setParameter(ollieRosTools::VoNode_paramsConfig &config, uint32_t level){
+        kernel     = static_cast<Kernel>(config.vo_poseOptKernel);
+        rounds     = config.vo_poseOptRounds;
+        iterations = config.vo_poseOptIter;
+    }
+
+private:
+    // IRLS weight of a squared residual e2 for a kernel of squared width k2
+    double weight(const double e2, const double k2) const {
+        switch (kernel){
+            case KERNEL_HUBER:  return e2<=k2 ? 1.0 : std::sqrt(k2/e2);
+            case KERNEL_CAUCHY: return 1.0/(1.0+e2/k2);
+            default:            return 1.0;
+        }
+    }
+
+    Kernel kernel;
+    int rounds;      // inlier re-classifications
+    int iterations;  // Gauss-Newton iterations per round
+    int minInliers;
+};
+
+#endif // POSEOPTIMIZER_HPP
@@ -38,7 +38,8 @@ class PreProcNode{
 
 
 	public:
-        PreProcNode(ros::NodeHandle& _n);
+        /// _n is used for topics, _pn for dynamic reconfigure. The standalone node uses ~, the nodelet its private handle
+        PreProcNode(ros::NodeHandle& _n, const ros::NodeHandle& _pn = ros::NodeHandle("~"));
         ~PreProcNode();
 
 	private:
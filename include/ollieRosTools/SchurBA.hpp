@@ -0,0 +1,109 @@
+#ifndef SCHURBA_HPP
+#define SCHURBA_HPP
+
+#include <vector>
+#include <Eigen/StdVector>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <Eigen/Cholesky>
+
+#include <ros/ros.h>
+
+#include <ollieRosTools/BundleAdjuster.hpp>
+#include <ollieRosTools/aux.hpp>
+
+
+
+/// Levenberg-Marquardt bundle adjustment specialised for our problem: 6 DoF keyframe poses, 3D landmarks and the
+/// image plane (depth 1) reprojection error of EdgePoseLandmarkReprojectBV. No graph, no virtual calls, all blocks have
+/// compile time sizes and live in flat arrays (structure of arrays, observations grouped by landmark).
+/// Landmarks are eliminated with a hand rolled Schur complement. The reduced camera system is small
+/// (6 x nr of free keyframes) and solved densely. Linearisation, Schur accumulation and cost evaluation are parallel over
+/// landmarks with OpenMP, each thread accumulating its own camera blocks.
+/// Uses the same robust kernel (Huber, width 1), fixed keyframes and termination rules as the g2o path.
+class SchurBA {
+public:
+    SchurBA();
+
+    // Optimises p in place. Returns the number of iterations done
+    int solve(BAProblem& p);
+
+    // Marginal covariance of the free keyframe poses of p at its current estimate, ignoring the observations flagged as
+    // outliers. Fills p.poseCov and p.poseCovInd, in the (translation, rotation) increments t += R*dt, R = R*exp(dw).
+    // Works for results of either solver
+    bool marginals(BAProblem& p);
+
+private:
+    typedef Eigen::Matrix<double, 6, 6> Mat66;
+    typedef Eigen::Matrix<double, 6, 3> Mat63;
+    typedef Eigen::Matrix<double, 6, 1> Vec6;
+    typedef std::vector<Eigen::Matrix3d, Eigen::aligned_allocator<Eigen::Matrix3d> > Mat33s;
+    typedef std::vector<Mat66, Eigen::aligned_allocator<Mat66> > Mat66s;
+    typedef std::vector<Mat63, Eigen::aligned_allocator<Mat63> > Mat63s;
+    typedef std::vector<Vec6, Eigen::aligned_allocator<Vec6> > Vec6s;
+    typedef std::vector<Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d> > Vec3s;
+    typedef std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d> > Vec2s;
+
+    // Copies p into the flat layout below
+    void setup(const BAProblem& p);
+    // LM iterations from the current estimate until maxIter, the gain threshold or the budget [s] since tStart. Updates chi
+    int iterate(const int maxIter, const double gainThresh, const double budget, const ros::WallTime& tStart, double& chi, const char*& reason);
+    // Robust cost of the current estimate, without culled observations
+    double cost() const;
+    // Marks the observations whose point is behind the camera at the current estimate
+    void updateBehind();
+    // Number of observations in front of the camera at the last updateBehind() that are behind it now
+    uint movedBehind() const;
+    // Fills U, gc, V, gl and W at the current estimate
+    void linearise();
+    // Damps and eliminates the landmarks into the reduced camera system S, b (upper triangle)
+    void reduce(const double lambda);
+    // Damps, eliminates the landmarks and solves for the camera and landmark steps. False if the system could not be solved
+    bool solveStep(const double lambda);
+
+    // Residual, jacobians and robust weight of observation k. Returns false if the point is behind the camera
+    bool evaluate(const uint k, Eigen::Vector2d& e, Eigen::Matrix<double, 2, 6>& Jc, Eigen::Matrix<double, 2, 3>& Jl, double& w) const;
+    // Squared error of observation k, -1 if the point is behind the camera
+    double error2(const uint k) const;
+    double robust(const double e2) const;
+    double robustWeight(const double e2) const;
+
+    bool huber;
+
+    /// Cameras
+    Mat33s R;           // rotation camera -> world
+    Vec3s t;            // position in the world
+    Ints camFree;       // index in the reduced camera system, -1 if fixed
+    uint nrFree;
+    Mat66s U;           // J'J of all observations of a camera
+    Vec6s gc;           // J'e
+    Vec6s dc;           // step
+
+    /// Landmarks
+    Vec3s X;
+    Ints lmStart;       // observations of landmark j are lmStart[j]..lmStart[j+1]-1
+    Mat33s V;
+    Vec3s gl;
+    Mat33s Vinv;        // of the damped V
+    Vec3s dl;
+
+    /// Observations, sorted by landmark
+    Ints obsCam;
+    Ints obsLm;
+    Vec2s meas;
+    Ints obsIdx;        // index in BAProblem::obs
+    UChars obsOut;      // culled as outlier, ignored from then on
+    UChars obsBehind;   // point behind the camera at the last accepted estimate
+    Mat63s W;           // Jc'Jl
+
+    /// Reduced camera system
+    Eigen::MatrixXd S;
+    Eigen::VectorXd b;
+
+    /// Backup for rejected steps
+    Mat33s Rold;
+    Vec3s told;
+    Vec3s Xold;
+};
+
+#endif // SCHURBA_HPP
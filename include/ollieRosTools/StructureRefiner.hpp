@@ -0,0 +1,70 @@
+#ifndef STRUCTUREREFINER_HPP
+#define STRUCTUREREFINER_HPP
+
+#include <vector>
+#include <Eigen/StdVector>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <Eigen/Eigenvalues>
+
+#include <ros/ros.h>
+
+#include <ollieRosTools/VoNode_paramsConfig.h>
+#include <ollieRosTools/aux.hpp>
+#include <ollieRosTools/Landmark.hpp>
+#include <ollieRosTools/Frame.hpp>
+#include <ollieRosTools/BundleAdjuster.hpp>
+
+
+
+/// Structure only refinement of landmarks: each landmark is moved to best explain all its observations with the keyframe
+/// poses held fixed. Every landmark is an independent 3x3 Gauss-Newton problem, so they are solved in parallel.
+/// The residual is the predicted bearing in a tangent basis of the observed one (as in the PoseOptimizer), weighted with a
+/// Huber kernel. Steps that do not lower the cost or would put the point behind a camera are rejected, as are landmarks
+/// whose normal equations are ill conditioned (not enough parallax).
+/// Observations are gathered and results written back serially, frames and landmarks are not touched while solving.
+/// Used to warm start BA on its snapshot (in the BA thread) and to refine the landmarks of a new keyframe when no BA runs for it.
+/// An instance must only be used by one thread at a time.
+class StructureRefiner {
+public:
+    StructureRefiner();
+
+    // Refines lms in place. Returns the number of landmarks that moved
+    uint refine(const Landmark::Ptrs& lms);
+    // Refines the landmarks of a BA snapshot in place, the map is not touched. Returns the number of landmarks that moved
+    uint refine(BAProblem& p);
+
+    void setParameter(ollieRosTools::VoNode_paramsConfig &config, uint32_t level);
+
+private:
+    typedef std::vector<Eigen::Matrix3d, Eigen::aligned_allocator<Eigen::Matrix3d> > Mat33s;
+    typedef std::vector<Eigen::Matrix<double, 2, 3>, Eigen::aligned_allocator<Eigen::Matrix<double, 2, 3> > > Mat23s;
+    typedef std::vector<Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d> > Vec3s;
+
+    // Clears the observations and landmarks
+    void clear(const uint nrLms);
+    // Adds an observation of the last landmark from a camera at pose (camera -> world) along bearing f
+    void addObservation(const Pose& pose, const Eigen::Vector3d& f);
+    // Solves every landmark on its own, sets X and moved
+    void solve();
+    // Robust cost of landmark j at position x. Returns false if x is behind one of its cameras
+    bool cost(const uint j, const Eigen::Vector3d& x, double& chi2) const;
+
+    /// Settings
+    int iterations;
+    double k2;        // squared huber width in tangent plane units
+    bool huber;
+
+    /// Observations, grouped by landmark
+    Ints obsStart;    // observations of landmark j are obsStart[j]..obsStart[j+1]-1
+    Mat33s Rt;        // world -> camera rotation
+    Vec3s t;          // camera position
+    Vec3s bv;         // observed bearing, camera frame
+    Mat23s basis;     // tangent basis of the observed bearing, camera frame
+
+    /// Landmarks
+    Vec3s X;
+    UChars moved;     // not Bools, written in parallel
+};
+
+#endif // STRUCTUREREFINER_HPP
@@ -0,0 +1,37 @@
+#ifndef TRIANGULATION_HPP
+#define TRIANGULATION_HPP
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <ollieRosTools/aux.hpp>
+
+
+
+/// Batch triangulation of aligned bearing vector pairs. Instead of calling opengv per point, all pairs are
+/// processed at once on structure of arrays bearings (N x 3 column major, ie all x, then all y, then all z)
+/// so the compiler can vectorise every step. Besides the points a validity mask is returned, a point is valid if
+///  - it lies in front of both cameras (cheirality)
+///  - the rays have enough parallax
+///  - it reprojects onto both bearings within the given error (1-cos, BVERR_OneMinusAdotB)
+namespace OVO {
+
+    enum TRIANGULATION_METHOD {TRI_LINEAR = 1,  // Linear least squares over both rays, reweighted by inverse depth so it minimises the angular error
+                               TRI_MIDPOINT = 2 // Midpoint of the common perpendicular, same as opengv::triangulation::triangulate2
+                              };
+
+    // SoA bearing vectors, one row per bearing
+    typedef Eigen::Matrix<double, Eigen::Dynamic, 3> BearingsSoA;
+
+    // Copies AoS bearing vectors to SoA ones
+    void bearings2SoA(const Bearings& bv, BearingsSoA& bvSoA);
+
+    // Triangulates bv1[i] <-> bv2[i]. trans1to2 is the pose of frame 2 in frame 1, points are returned in frame 1.
+    // minParallaxDeg <= 0 and maxError <= 0 disable the corresponding checks
+    void triangulateBatch(const Pose& trans1to2, const BearingsSoA& bv1, const BearingsSoA& bv2,
+                          Points3d& points, Bools& valid,
+                          const TRIANGULATION_METHOD method = TRI_MIDPOINT,
+                          const double minParallaxDeg = 0,
+                          const double maxError = 0);
+}
+
+#endif // TRIANGULATION_HPP
@@ -24,10 +24,15 @@
 #include <tf/transform_broadcaster.h>
 #include <tf/transform_listener.h>
 #include <sensor_msgs/image_encodings.h>
+#include <sensor_msgs/Imu.h>
 
 
 #include <ollieRosTools/VoNode_paramsConfig.h>
 #include <ollieRosTools/Frame.hpp>
+#include <ollieRosTools/ImageQuality.hpp>
+#include <ollieRosTools/BlurPredictor.hpp>
+#include <ollieRosTools/ImuBuffer.hpp>
+#include <ollieRosTools/FrameScheduler.hpp>
 #include <ollieRosTools/Odometry.hpp>
 #include <ollieRosTools/aux.hpp>
 #include <ollieRosTools/synthFrame.h>
@@ -48,6 +53,7 @@ class VoNode{
         cv::Ptr<CameraATAN> cameraModel;
         cv::Ptr<Detector> detector;
         cv::Ptr<PreProc> preproc;
+        cv::Ptr<ImageQuality> imageQuality;
 
         /// ROS specific stuff
         ros::NodeHandle& n;
@@ -56,6 +62,7 @@ class VoNode{
         image_transport::Publisher pubImage;
         image_transport::Subscriber subImage;
         ros::Subscriber subSynthetic;
+        ros::Subscriber subImu;
         ros::Publisher pubMarker;
         ros::Publisher pubTrack;
         tf::TransformBroadcaster pubTF;
@@ -70,6 +77,12 @@ class VoNode{
         float timeAlpha;
         ros::Time lastTime; // Keep track of time to detect loops in bag files
         Odometry odometry;
+        BlurPredictor blurPredictor;
+        FrameScheduler scheduler;
+
+        /// Recent IMU samples. The IMU callback might run in a different thread (nodelet), the buffer is lock free
+        ImuBuffer imuBuffer;
+        ros::Time lastImuTime;
 
 
         /// Dynamic parameters
@@ -77,6 +90,7 @@ class VoNode{
         float timeAvg;
         int colorId;
         ros::Duration imgDelay;
+        double imuMaxLate;
 
         /// Display stuff
         void publishStuff(bool all = true){
@@ -119,14 +133,18 @@ class VoNode{
 
         /// Parameters
         std::string inputTopic;
+        std::string imuTopic;
 
         /// Callbacks
         void incomingImage(const sensor_msgs::ImageConstPtr& msg);
         void incomingSynthetic(const ollieRosTools::synthFrameConstPtr& msg);
+        void incomingImu(const sensor_msgs::ImuConstPtr& msg);
         ollieRosTools::VoNode_paramsConfig&  setParameter(ollieRosTools::VoNode_paramsConfig &config, uint32_t level);
 
         /// Utility Functions
         void initImu2Cam();
+        bool getImuAttitude(const ros::Time& t, tf::StampedTransform& imuStamped);
+        bool getImuRates(const ros::Time& t, Eigen::Vector3d& gyro, Eigen::Vector3d& acc);
 
 
 
@@ -163,6 +163,16 @@ namespace OVO {
     void relativeRotation(const Eigen::Matrix3d& ImuRotFrom,const Eigen::Matrix3d& ImuRotTo, Eigen::Matrix3d& rotRelative);
     // returns the angle from a px distance
     double px2degrees(const double px, const double horiFovDeg = 110., const double width = 720);
+    // rows span the plane orthogonal to the unit bearing bv, bearing residuals are expressed in it
+    Eigen::Matrix<double, 2, 3> tangentBasis(const Bearing& bv);
+    // squared length of the tangent residual (sin^2 of the angle) for a 1-cos(angle) bearing error
+    double error2tangentSq(const double error);
+    // same as above given a px distance
+    double px2tangentSq(const double px);
+    // Camera position in the world given its rotation R (camera -> world, eg from the IMU) and bearings aligned with world points. Linear least squares over ind
+    Eigen::Vector3d translationKnownRotationAbs(const Eigen::Matrix3d& R, const Bearings& bv, const Points3d& points, const Ints& ind);
+    // Unit translation of frame 2 in frame 1 given the rotation R12 (eg from the IMU) and aligned bearings. Linear least squares over ind
+    Eigen::Vector3d translationKnownRotationRel(const Eigen::Matrix3d& R12, const Bearings& bv1, const Bearings& bv2, const Ints& ind);
 
     /// Utility Functions
     // Return approximate median of a list of values. Note: may change the input vector!!
@@ -21,6 +21,10 @@ public:
     virtual bool read(std::istream& is);
     virtual bool write(std::ostream& os) const;
     void         computeError();
+    // Analytic jacobians wrt the (x,y,z,qx,qy,qz) pose increment of VertexPose and the landmark position
+    virtual void linearizeOplus();
+    // True if the landmark is in front of the camera
+    bool isDepthPositive() const;
 
 };
 
@@ -20,6 +20,9 @@ public:
     write(std::ostream& os) const;
     void
     computeError();
+    // Analytic jacobians wrt the (x,y,z,qx,qy,qz) increments of both poses
+    virtual void
+    linearizeOplus();
 
 };
 
@@ -34,6 +34,15 @@
     return v;
   }
 
+  // skew symmetric matrix such that skew(a)*b = a.cross(b)
+  inline Eigen::Matrix3d skew(const Eigen::Vector3d& v){
+    Eigen::Matrix3d m;
+    m <<     0, -v[2],  v[1],
+          v[2],     0, -v[0],
+         -v[1],  v[0],     0;
+    return m;
+  }
+
   /**
   * compute a fast approximation for the nearest orthogonal rotation matrix.
   * The function computes the residual E = RR^T - I which is then used as follows:
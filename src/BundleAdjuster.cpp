@@ -0,0 +1,253 @@
+#include <ollieRosTools/BundleAdjuster.hpp>
+
+
+BundleAdjuster::BundleAdjuster():
+    optimizer(0),
+    dense(false),
+    huber(false),
+    nrSolves(0),
+    nrRebuilds(0){
+}
+
+BundleAdjuster::~BundleAdjuster(){
+    reset();
+}
+
+
+
+void BundleAdjuster::reset(){
+    if (optimizer){
+        // the optimizer owns all vertices and edges
+        optimizer->clear();
+        delete optimizer;
+        optimizer = 0;
+        ROS_INFO("g2o = Dropped persistent graph with [%lu] poses, [%lu] landmarks and [%lu] edges", poses.size(), lms.size(), edges.size());
+    }
+    poses.clear();
+    lms.clear();
+    edges.clear();
+}
+
+
+
+void BundleAdjuster::makeOptimizer(const bool d){
+    reset();
+    optimizer = new g2o::SparseOptimizer();
+    optimizer->setVerbose(true);
+    g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
+    if (d) {
+        linearSolver= new g2o::LinearSolverDense<g2o::BlockSolver_6_3::PoseMatrixType>();
+    } else {
+        linearSolver = new g2o::LinearSolverCholmod<g2o::BlockSolver_6_3::PoseMatrixType>();
+    }
+    g2o::BlockSolver_6_3 * solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
+    g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
+    optimizer->setAlgorithm(solver);
+    dense = d;
+    ROS_INFO("g2o = Created new %s optimizer", dense ? "dense" : "cholmod");
+}
+
+
+
+void BundleAdjuster::solve(BAProblem& p){
+    ROS_INFO("g2o > Doing G2O Bundle adjustment with [%lu] KeyFrames, [%lu] LandMarks and [%lu] observations", p.kfs.size(), p.lms.size(), p.obs.size());
+    ros::WallTime tStart = ros::WallTime::now();
+    ++nrSolves;
+
+    bool changed = false; // graph structure changed, g2o has to rebuild its indices and Hessian structure
+    if (!optimizer || p.dense != dense){
+        makeOptimizer(p.dense);
+        changed = true;
+    }
+
+    /// Wanted state
+    std::map<int, uint> kfInd;
+    for (uint i=0; i<p.kfs.size(); ++i){
+        kfInd[p.kfs[i].kfId] = i;
+    }
+    std::map<int, uint> lmInd;
+    for (uint i=0; i<p.lms.size(); ++i){
+        lmInd[p.lms[i].id] = i;
+    }
+    std::map<EdgeKey, uint> obsInd;
+    for (uint i=0; i<p.obs.size(); ++i){
+        obsInd[EdgeKey(p.obs[i].kfId, p.obs[i].lmId)] = i;
+    }
+
+    /// Remove edges first so no vertex is removed while something still points at it
+    uint edgesRemoved = 0;
+    for (EdgeMap::iterator it = edges.begin(); it != edges.end();){
+        if (obsInd.find(it->first) == obsInd.end()){
+            optimizer->removeEdge(it->second);
+            edges.erase(it++);
+            ++edgesRemoved;
+        } else {
+            ++it;
+        }
+    }
+
+    uint posesRemoved = 0;
+    for (PoseMap::iterator it = poses.begin(); it != poses.end();){
+        if (kfInd.find(it->first) == kfInd.end()){
+            optimizer->removeVertex(it->second);
+            poses.erase(it++);
+            ++posesRemoved;
+        } else {
+            ++it;
+        }
+    }
+
+    uint lmsRemoved = 0;
+    for (LandmarkMap::iterator it = lms.begin(); it != lms.end();){
+        if (lmInd.find(it->first) == lmInd.end()){
+            optimizer->removeVertex(it->second);
+            lms.erase(it++);
+            ++lmsRemoved;
+        } else {
+            ++it;
+        }
+    }
+    changed = changed || edgesRemoved>0 || posesRemoved>0 || lmsRemoved>0;
+
+    bool ok;
+
+    /// Add new frames, update existing ones
+    uint posesAdded = 0;
+    for (uint i=0; i<p.kfs.size();++i){
+        PoseMap::iterator it = poses.find(p.kfs[i].kfId);
+        VertexPose* v_pose;
+        if (it == poses.end()){
+            v_pose = new VertexPose();
+            v_pose->setId(p.kfs[i].kfId); //set id using unique statid id of keyframe class
+            v_pose->setFixed(p.kfs[i].fixed);
+            v_pose->setEstimate(Eigen::Isometry3d(p.kfs[i].pose.matrix()));
+            ok = optimizer->addVertex(v_pose);
+            ROS_ASSERT_MSG(ok, "g2o = Could not add v_pose of keyframe [%d] to pose graph", p.kfs[i].kfId);
+            poses[p.kfs[i].kfId] = v_pose;
+            ++posesAdded;
+        } else {
+            v_pose = it->second;
+            if (v_pose->fixed() != p.kfs[i].fixed){
+                // fixed vertices are not part of the Hessian
+                v_pose->setFixed(p.kfs[i].fixed);
+                changed = true;
+            }
+            v_pose->setEstimate(Eigen::Isometry3d(p.kfs[i].pose.matrix()));
+        }
+    }
+
+    /// Add new land marks, update existing ones
+    uint lmsAdded = 0;
+    for (uint i=0; i<p.lms.size(); ++i){
+        LandmarkMap::iterator it = lms.find(p.lms[i].id);
+        if (it == lms.end()){
+            VertexLandmarkXYZ * v_lm = new VertexLandmarkXYZ();
+            v_lm->setId(p.lms[i].id+MAX_KF); //set id using unique static id of landmark class + offset
+            v_lm->setMarginalized(true);
+            v_lm->setFixed(false);
+            v_lm->setEstimate(p.lms[i].position);
+            ok = optimizer->addVertex(v_lm);
+            ROS_ASSERT_MSG(ok, "g2o = Could not add v_landmark [%d] to pose graph", p.lms[i].id);
+            lms[p.lms[i].id] = v_lm;
+            ++lmsAdded;
+        } else {
+            it->second->setEstimate(p.lms[i].position);
+        }
+    }
+
+    /// Add new observations, update the measurements of existing ones
+    uint edgesAdded = 0;
+    for (uint i=0; i<p.obs.size(); ++i){
+        const EdgeKey key(p.obs[i].kfId, p.obs[i].lmId);
+        EdgeMap::iterator it = edges.find(key);
+        if (it == edges.end()){
+            EdgePoseLandmarkReprojectBV * ef = new EdgePoseLandmarkReprojectBV();
+            ef->setVertex(0, poses[p.obs[i].kfId]); //get association via KF id
+            ef->setVertex(1, lms[p.obs[i].lmId]);
+            ef->setMeasurement(p.obs[i].measurement);
+            ef->setInformation(Eigen::Matrix2d::Identity());
+            if (p.huber) {
+                ef->setRobustKernel(new g2o::RobustKernelHuber);
+            }
+            ok = optimizer->addEdge(ef);
+            ROS_ASSERT_MSG(ok, "g2o = Could not add edge between Landmark [%d] and keyframe [%d] to pose graph", p.obs[i].lmId, p.obs[i].kfId);
+            edges[key] = ef;
+            ++edgesAdded;
+        } else {
+            it->second->setMeasurement(p.obs[i].measurement);
+        }
+    }
+    changed = changed || posesAdded>0 || lmsAdded>0 || edgesAdded>0;
+
+    /// Robust kernel setting changed, swap it on all old edges. New ones already have the right one
+    if (p.huber != huber){
+        for (EdgeMap::iterator it = edges.begin(); it != edges.end(); ++it){
+            if (p.huber && !it->second->robustKernel()){
+                it->second->setRobustKernel(new g2o::RobustKernelHuber);
+            } else if (!p.huber && it->second->robustKernel()){
+                it->second->setRobustKernel(0);
+            }
+        }
+        huber = p.huber;
+    }
+
+    ros::WallTime tSetup = ros::WallTime::now();
+    ROS_INFO("g2o = Graph update: poses [+%u -%u], landmarks [+%u -%u], edges [+%u -%u] [%.1fms]",
+             posesAdded, posesRemoved, lmsAdded, lmsRemoved, edgesAdded, edgesRemoved, (tSetup-tStart).toSec()*1000.);
+
+
+    /// Run optimisation
+    if (changed){
+        ++nrRebuilds;
+        optimizer->initializeOptimization();
+    }
+    ROS_INFO("g2o > Performing full BA %s:", changed ? "with new structure" : "reusing the previous structure");
+    BATerminateAction terminate(*optimizer, p.gain, p.budget);
+    optimizer->addPostIterationAction(&terminate);
+    const int iterations = optimizer->optimize(p.iter, !changed);
+    optimizer->removePostIterationAction(&terminate);
+    optimizer->setForceStopFlag(0);
+    ros::WallTime tOpt = ros::WallTime::now();
+    optimizer->computeActiveErrors();
+    p.iterations = iterations;
+    ROS_INFO("g2o < Stopped after [%d/%d] iterations: %s. Chi2 [%g]", iterations, p.iter, terminate.getReason(), optimizer->activeRobustChi2());
+
+    /// Cull observations with a large error (or behind the camera) and re-optimise briefly without them.
+    // Their edges are removed from the persistent graph, the map drops the observations when applying the results
+    p.outliers.assign(p.obs.size(), false);
+    p.nrOutliers = 0;
+    if (p.outlierChi2>0){
+        for (uint i=0; i<p.obs.size(); ++i){
+            EdgeMap::iterator it = edges.find(EdgeKey(p.obs[i].kfId, p.obs[i].lmId));
+            EdgePoseLandmarkReprojectBV* e = it->second;
+            if (e->chi2()>p.outlierChi2 || !e->isDepthPositive()){
+                optimizer->removeEdge(e);
+                edges.erase(it);
+                p.outliers[i] = true;
+                ++p.nrOutliers;
+            }
+        }
+        if (p.nrOutliers>0){
+            ++nrRebuilds;
+            optimizer->initializeOptimization();
+            if (p.outlierIter>0){
+                p.iterations += optimizer->optimize(p.outlierIter);
+            }
+            optimizer->computeActiveErrors();
+        }
+        ROS_INFO("g2o = Culled [%u/%lu] outlier observations [%.1fms]", p.nrOutliers, p.obs.size(), (ros::WallTime::now()-tOpt).toSec()*1000.);
+    }
+    p.chi2 = optimizer->activeRobustChi2();
+
+    /// Read back results
+    for (uint i=0; i<p.kfs.size();++i){
+        p.kfs[i].pose = poses[p.kfs[i].kfId]->estimate();
+    }
+    for (uint i=0; i<p.lms.size(); ++i){
+        p.lms[i].position = lms[p.lms[i].id]->estimate();
+    }
+
+    p.time = (ros::WallTime::now()-tStart).toSec();
+    ROS_INFO("g2o < Done BA [Setup: %.1fms] [Opti: %.1fms] [Total: %.1fms] Structure rebuilt in [%u/%u] runs",
+             (tSetup-tStart).toSec()*1000., (tOpt-tSetup).toSec()*1000., p.time*1000., nrRebuilds, nrSolves);
+}
@@ -8,11 +8,10 @@ cv::Ptr<Detector>   Frame::detector    =  cv::Ptr<Detector>();
 cv::Ptr<PreProc>    Frame::preproc     =  cv::Ptr<PreProc>();
 int Frame::idCounter   = -1;
 int Frame::kfIdCounter   = -1;
-float Frame::averageQuality = 0.8;
 cv::Mat Frame::mask;
 cv::Mat Frame::maskRect;
 
-Frame::Frame(const cv::Mat& img, const tf::StampedTransform& imu) : initialised(true) {
+Frame::Frame(const cv::Mat& img, const tf::StampedTransform& imu, const float imgQuality) : initialised(true) {
     id = ++idCounter;
     kfId = -1;
 
@@ -24,8 +23,8 @@ Frame::Frame(const cv::Mat& img, const tf::StampedTransform& imu) : initialised(
     timeExtract    = 0;
     timeDetect     = 0;
 
-    /// SHOULD BE SET SOMEHOW
-    gyroX = gyroY = GyroZ = 0.0;
+    // Set from the IMU stream via setImuRates
+    gyroX = gyroY = gyroZ = 0.0;
     accX  = accY  = accZ  = 0.0;
 
     detectorId = -1; //-1 = none, -2 = KLT
@@ -34,8 +33,6 @@ Frame::Frame(const cv::Mat& img, const tf::StampedTransform& imu) : initialised(
     ros::WallTime t0 = ros::WallTime::now();
     cv::Mat imgProc = preproc->process(img);
 
-    image_orig = img.clone();
-
     image = cameraModel->rectify(imgProc);
 
     timePreprocess = (ros::WallTime::now()-t0).toSec();
@@ -52,8 +49,8 @@ Frame::Frame(const cv::Mat& img, const tf::StampedTransform& imu) : initialised(
     OVO::tf2RPY(imu, roll, pitch, yaw);
     roll*=-1.;
 
-    /// TODO: estiamte quality of imageu using acceleromter, gyro and blurriness estiamtion
-    estimateImageQuality();
+    // Estimated before construction on the raw image so bad frames dont cost anything
+    quality = imgQuality;
 
     hasPoseEstimate = false;
 
@@ -78,10 +75,10 @@ void Frame::addLandMarkRef(int idx, const Landmark::Ptr& lm){
 }
 
 void Frame::removeLandMarkRef(const int id){
-    ROS_ASSERT_MSG(!landmarkRefs[id].empty(), "FRA = LandmarkRef [%d] Cannot be removed, no landmark there!", id);
-    //p.release(); ?
-    landmarkRefs.at(id)->removeObservation(getId(), getKfId());
-    //landmarkRefs[id] = Landmark::Ptr();
+    Landmark::IntMap::iterator it = landmarkRefs.find(id);
+    ROS_ASSERT_MSG(it != landmarkRefs.end() && !it->second.empty(), "FRA = LandmarkRef [%d] Cannot be removed, no landmark there!", id);
+    it->second->removeObservation(getId(), getKfId());
+    landmarkRefs.erase(it);
 }
 
 // Prepares the keyframe for removal. Remove all references to landmarks and landmarks references to it
@@ -0,0 +1,129 @@
+#include "ollieRosTools/ImageQuality.hpp"
+#include <ollieRosTools/aux.hpp>
+#include <algorithm>
+#include <cmath>
+
+
+ImageQuality::ImageQuality():
+    on(true),
+    scale(0.25),
+    blurRatio(0.5),
+    noiseMax(6),
+    qualityThresh(0.9),
+    dropoutThresh(40),
+    sharpness(-1),
+    sharpnessAvg(-1),
+    noise(-1),
+    time(0){
+
+    // Immerkaer, "Fast Noise Variance Estimation", 1996. Difference of two laplacians, insensitive to image structure
+    noiseKernel = (cv::Mat_<float>(3,3) << 1, -2, 1,
+                                          -2,  4,-2,
+                                           1, -2, 1);
+}
+
+
+
+void ImageQuality::setMask(const cv::Mat& maskIn){
+    // Same convention as Frame::setMask. After this 255 = valid
+    if (maskIn.empty()){
+        mask = cv::Mat();
+    } else {
+        cv::threshold(maskIn, mask, 100, 255, cv::THRESH_BINARY_INV);
+    }
+    maskSmall = cv::Mat();
+}
+
+
+
+bool ImageQuality::dropout(const cv::Mat& img) const {
+    /// The left and right border columns of the analog image are black. If not the line has dropped out.
+    double maxValL, maxValR;
+    // reshape so we can also deal with colour images, minMaxLoc only takes single channels
+    cv::minMaxLoc(img.colRange(0,8).reshape(1), NULL, &maxValL);
+    if (maxValL>dropoutThresh){
+        return true;
+    }
+    cv::minMaxLoc(img.colRange(img.cols-9,img.cols).reshape(1), NULL, &maxValR);
+    return maxValR>dropoutThresh;
+}
+
+
+
+float ImageQuality::estimate(const cv::Mat& img){
+    if (!on || img.empty()){
+        return -1.f;
+    }
+
+    ROS_INFO("IQE > Computing Image Quality");
+    ros::WallTime t0 = ros::WallTime::now();
+
+    /// Dropouts
+    if (dropout(img)){
+        time = (ros::WallTime::now()-t0).toSec();
+        ROS_WARN("IQE < Computed Image Quality FAIL (dropout) [%.2fms]", time*1000.);
+        return 0.01f;
+    }
+
+    /// Downsample. INTER_AREA also averages the two fields of interlaced images
+    cv::Mat small;
+    cv::resize(img, small, cv::Size(), scale, scale, cv::INTER_AREA);
+    if (small.channels()>1){
+        cv::cvtColor(small, small, CV_BGR2GRAY);
+    }
+
+    // Mask only changes size when the input does, so cache it. Eroded so the mask border does not show up as an edge
+    if (!mask.empty() && maskSmall.size()!=small.size()){
+        cv::resize(mask, maskSmall, small.size(), 0, 0, cv::INTER_NEAREST);
+        cv::erode(maskSmall, maskSmall, cv::Mat(), cv::Point(-1,-1), 2);
+    }
+
+    /// Blur: variance of the laplacian
+    cv::Mat lap;
+    cv::Scalar mean, stdDev;
+    cv::Laplacian(small, lap, CV_16S, 1);
+    cv::meanStdDev(lap, mean, stdDev, maskSmall);
+    sharpness = stdDev[0]*stdDev[0];
+
+    /// Noise: sigma = sqrt(pi/2)/6 * mean(|I*N|). Scale back up as INTER_AREA averaged 1/scale^2 pixels
+    cv::Mat noiseImg;
+    cv::filter2D(small, noiseImg, CV_32F, noiseKernel);
+    noiseImg = cv::abs(noiseImg);
+    noise = std::sqrt(M_PI*0.5)/6. * cv::mean(noiseImg, maskSmall)[0] / scale;
+
+    /// Combine. Sharpness is scene dependant so we compare it against its recent history
+    if (sharpnessAvg<0){
+        sharpnessAvg = sharpness;
+    }
+    const float qBlur  = std::min(1.f, sharpness / std::max(1e-6f, sharpnessAvg*blurRatio));
+    const float qNoise = noise>noiseMax ? noiseMax/noise : 1.f;
+    const float quality = qBlur*qNoise;
+
+    // Running average
+    const float alpha = 0.9;
+    sharpnessAvg = sharpnessAvg*alpha + sharpness*(1.f-alpha);
+
+    time = (ros::WallTime::now()-t0).toSec();
+    if (isGood(quality)){
+        ROS_INFO("IQE < Computed Image Quality OKAY: %.2f [Sharp: %.1f/%.1f Noise: %.1f] [%.2fms]", quality, sharpness, sharpnessAvg, noise, time*1000.);
+    } else {
+        ROS_WARN("IQE < Computed Image Quality FAIL: %.2f [Sharp: %.1f/%.1f Noise: %.1f] [%.2fms]", quality, sharpness, sharpnessAvg, noise, time*1000.);
+    }
+    return quality;
+}
+
+
+
+void ImageQuality::setParameter(ollieRosTools::VoNode_paramsConfig &config, uint32_t level){
+    ROS_INFO("IQE > SETTING PARAMS");
+    on = config.iq_on;
+    if (scale != static_cast<float>(config.iq_scale)){
+        scale = config.iq_scale;
+        maskSmall = cv::Mat();
+    }
+    blurRatio = config.iq_blurRatio;
+    noiseMax = config.iq_noiseMax;
+    qualityThresh = config.iq_thresh;
+    dropoutThresh = config.iq_dropoutThresh;
+    ROS_INFO("IQE < PARAMS SET");
+}
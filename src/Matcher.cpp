@@ -276,6 +276,146 @@ double Matcher::matchFrame(FramePtr f, FramePtr kf, DMatches& matches, double& t
 }
 
 
+
+// MATCHING AGAINST KEYFRAME WITH A PREDICTED POSE
+double Matcher::matchFramePredicted(FramePtr f, FramePtr kf, const Pose& fPose, DMatches& matches, double& time, const Ints& kfMask){
+    ROS_INFO("MAT [H] > matchFramePredicted QueryFrame[%d|%d] vs TrainFrame[%d|%d]", f->getId(), f->getKfId(), kf->getId(), kf->getKfId());
+    ROS_ASSERT(kf->poseEstimated());
+    ros::WallTime t0 = ros::WallTime::now();
+
+    const cv::Mat& qD =  f->getDescriptors();
+    const cv::Mat& tD = kf->getDescriptors();
+    const Eigen::MatrixXd& qBV =  f->getBearings();
+    const Eigen::MatrixXd& tBV = kf->getBearings();
+
+    /// Predict where the KF bearings are in f
+    // Points without landmarks only get rotated: bv_f = Rf'*Rkf*bv_kf
+    Eigen::MatrixXd tBVPred = tBV * (kf->getPose().linear().transpose() * fPose.linear());
+    // Points with landmarks get projected
+    const Pose inverseSolution = fPose.inverse();
+    const Landmark::IntMap& lms = kf->getLandmarkRefs();
+    for(Landmark::IntMap::const_iterator it = lms.begin(); it != lms.end(); ++it) {
+        tBVPred.row(it->first) = (inverseSolution * it->second->getPosition()).normalized().transpose();
+    }
+
+    cv::Mat mask = makeDisparityMask(qD.rows, tD.rows, qBV, tBVPred, m_bvDisparityThreshPred, OVO::BVERR_DEFAULT, Ints(), kfMask);
+
+    /// Do the actual matching
+    match(qD, tD, matches, time, mask);
+
+    /// Disparity is measured against the unpredicted kf bearings, it drives KF creation
+    double disparity = -1;
+    if (matches.size()>0){
+        Doubles error;
+        error.reserve(matches.size());
+        for(uint i=0; i<matches.size(); ++i){
+            error.push_back(OVO::errorNormalisedBV(qBV.block<1,3>(matches[i].queryIdx,0),tBV.block<1,3>(matches[i].trainIdx,0), OVO::BVERR_OneMinusAdotB));
+        }
+        disparity = OVO::medianApprox<double>(error);
+    }
+    ROS_INFO(OVO::colorise("MAT [H] < Matched [%lu] matches using the predicted pose with [%f] disparity in [%.1fms]", OVO::FG_BLUE).c_str(), matches.size(), disparity, 1000.*(ros::WallTime::now()-t0).toSec());
+    return disparity;
+}
+
+
+// MATCHING AGAINST KEYFRAME WITH PREDICTED KEYFRAME BEARINGS
+double Matcher::matchFrameBearings(FramePtr f, FramePtr kf, const Eigen::MatrixXd& kfBVPred, DMatches& matches, double& time, const Ints& kfMask){
+    ROS_INFO("MAT [H] > matchFrameBearings QueryFrame[%d|%d] vs TrainFrame[%d|%d] with [%lu] predicted points", f->getId(), f->getKfId(), kf->getId(), kf->getKfId(), kfMask.size());
+    ros::WallTime t0 = ros::WallTime::now();
+
+    const cv::Mat& qD =  f->getDescriptors();
+    const cv::Mat& tD = kf->getDescriptors();
+    const Eigen::MatrixXd& qBV =  f->getBearings();
+    ROS_ASSERT(kfBVPred.rows() == tD.rows);
+
+    // the prediction is only as good as the depth it used, so use the wider gate
+    cv::Mat mask = makeDisparityMask(qD.rows, tD.rows, qBV, kfBVPred, m_bvDisparityThresh, OVO::BVERR_DEFAULT, Ints(), kfMask);
+    match(qD, tD, matches, time, mask);
+
+    double disparity = -1;
+    if (matches.size()>0){
+        Doubles error;
+        error.reserve(matches.size());
+        for(uint i=0; i<matches.size(); ++i){
+            error.push_back(OVO::errorNormalisedBV(qBV.block<1,3>(matches[i].queryIdx,0),kfBVPred.block<1,3>(matches[i].trainIdx,0), OVO::BVERR_OneMinusAdotB));
+        }
+        disparity = OVO::medianApprox<double>(error);
+    }
+    ROS_INFO(OVO::colorise("MAT [H] < Matched [%lu] matches using predicted bearings with [%f] disparity in [%.1fms]", OVO::FG_BLUE).c_str(), matches.size(), disparity, 1000.*(ros::WallTime::now()-t0).toSec());
+    return disparity;
+}
+
+
+// KLT TRACKING AGAINST KEYFRAME
+double Matcher::trackFrame(FramePtr f, FramePtr fPrev, FramePtr kf, const DMatches& prevMatches, DMatches& matches, double& time){
+    ROS_INFO("MAT [H] > trackFrame Frame[%d|%d] from Frame[%d|%d] with [%lu] points matched against KeyFrame[%d|%d]", f->getId(), f->getKfId(), fPrev->getId(), fPrev->getKfId(), prevMatches.size(), kf->getId(), kf->getKfId());
+    ros::WallTime t0 = ros::WallTime::now();
+    matches.clear();
+
+    /// Points to track
+    const KeyPoints& prevKps = fPrev->getKeypoints(true);
+    Points2f prevPts;
+    prevPts.reserve(prevMatches.size());
+    for (uint i=0; i<prevMatches.size(); ++i){
+        prevPts.push_back(prevKps[prevMatches[i].queryIdx].pt);
+    }
+    if (prevPts.empty()){
+        time = (ros::WallTime::now()-t0).toSec();
+        ROS_WARN("MAT [H] < Nothing to track");
+        return -1;
+    }
+
+    /// Forward and backward KLT, reusing the cached pyramids
+    const Mats& prevPyr = fPrev->getPyramid(klt_window, klt_levels);
+    const Mats& pyr     = f->getPyramid(klt_window, klt_levels);
+    Points2f pts, backPts;
+    UChars status, backStatus;
+    Floats error, backError;
+    cv::calcOpticalFlowPyrLK(prevPyr, pyr, prevPts, pts, status, error, klt_window, klt_levels, klt_criteria, klt_flags, klt_eigenThresh);
+    backPts = prevPts;
+    cv::calcOpticalFlowPyrLK(pyr, prevPyr, pts, backPts, backStatus, backError, klt_window, klt_levels, klt_criteria, klt_flags | cv::OPTFLOW_USE_INITIAL_FLOW, klt_eigenThresh);
+
+    /// Keep points that track both ways onto themselves and stay inside the image. Keypoint meta data comes from the kf
+    const cv::Size size = f->getImage().size();
+    const KeyPoints& kfKps = kf->getKeypoints(true);
+    KeyPoints kps;
+    kps.reserve(pts.size());
+    matches.reserve(pts.size());
+    for (uint i=0; i<pts.size(); ++i){
+        const cv::Point2f& p = pts[i];
+        if (!status[i] || !backStatus[i] || p.x<0 || p.y<0 || p.x>=size.width || p.y>=size.height){
+            continue;
+        }
+        const cv::Point2f d = backPts[i]-prevPts[i];
+        if (d.dot(d) > 1.f){
+            continue;
+        }
+        cv::KeyPoint kp = kfKps[prevMatches[i].trainIdx];
+        kp.pt = p;
+        matches.push_back(cv::DMatch(kps.size(), prevMatches[i].trainIdx, error[i]));
+        kps.push_back(kp);
+    }
+    f->setTrackedKeypoints(kps);
+
+    /// Disparity vs kf, same as matchFrame
+    double disparity = -1;
+    if (matches.size()>0){
+        const Eigen::MatrixXd& qBV = f->getBearings();
+        const Eigen::MatrixXd& tBV = kf->getBearings();
+        Doubles errorBV;
+        errorBV.reserve(matches.size());
+        for(uint i=0; i<matches.size(); ++i){
+            errorBV.push_back(OVO::errorNormalisedBV(qBV.block<1,3>(matches[i].queryIdx,0),tBV.block<1,3>(matches[i].trainIdx,0), OVO::BVERR_OneMinusAdotB));
+        }
+        disparity = OVO::medianApprox<double>(errorBV);
+    }
+
+    time = (ros::WallTime::now()-t0).toSec();
+    ROS_INFO(OVO::colorise("MAT [H] < Tracked [%lu/%lu] points with [%f] disparity in [%.1fms]", OVO::FG_BLUE).c_str(), matches.size(), prevPts.size(), disparity, 1000.*time);
+    return disparity;
+}
+
+
 // Does KLT Refinement over matches. Returns matches that passed. Also updates keypoints of fQuery
 void Matcher::kltRefine(FramePtr fQuery, FramePtr fTrain, DMatches& matches, double& time){
     ROS_ASSERT(matches.size()>0);
@@ -362,6 +502,7 @@ void Matcher::setParameter(ollieRosTools::VoNode_paramsConfig &config, uint32_t
     m_max               = config.match_max;
     m_bvDisparityThresh = OVO::px2error(config.match_bvDisparityThresh);
     m_bvDisparityThreshMap = OVO::px2error(config.match_bvDisparityThreshMap);
+    m_bvDisparityThreshPred = OVO::px2error(config.match_bvDisparityThreshPred);
     m_pred              = static_cast<Prediction>(config.match_prediction);
     ROS_INFO("MAT [H] = Disparity theshold: %f Pixels = %f Degrees = %f error", config.match_bvDisparityThresh, OVO::px2degrees(config.match_bvDisparityThresh), m_bvDisparityThresh );
     ROS_INFO("MAT [H] = Disparity theshold Map: %f Pixels = %f Degrees = %f error", config.match_bvDisparityThreshMap, OVO::px2degrees(config.match_bvDisparityThreshMap), m_bvDisparityThreshMap );
@@ -537,6 +678,25 @@ void sortMatches(DMatches& ms){
 }
 
 
+// Compares two match indices by the distance of the matches they point to
+struct MatchIndDistLess {
+    const DMatches& ms;
+    MatchIndDistLess(const DMatches& ms): ms(ms){}
+    bool operator()(const int a, const int b) const {
+        return ms[a].distance < ms[b].distance;
+    }
+};
+
+// Indices of the matches sorted by increasing distance, leaving the matches themselves untouched
+void sortMatchesInd(const DMatches& ms, Ints& order){
+    order.resize(ms.size());
+    for (uint i=0; i<ms.size(); ++i){
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), MatchIndDistLess(ms));
+}
+
+
 // Reduces vector of vectors DMatchesKNN to a single vector DMatches
 void matchKnn2single(const DMatchesKNN& msknn, DMatches& ms, const size_t maxPerMatch){
     ms.clear();
@@ -0,0 +1,172 @@
+#include <ollieRosTools/PoseGraph.hpp>
+#include <set>
+#include <Eigen/Cholesky>
+
+#include <g2o/core/sparse_optimizer.h>
+#include <g2o/core/block_solver.h>
+#include <g2o/core/optimization_algorithm_levenberg.h>
+#include <g2o/solvers/dense/linear_solver_dense.h>
+
+#include <ollieRosTools/custom_types/math_functions.hpp>
+
+
+// Adjoint of T for right perturbations ordered (translation, rotation): T*exp(d)*T^-1 = exp(Ad*d)
+static PoseGraph::Matrix6d adjoint(const Pose& T){
+    PoseGraph::Matrix6d A = PoseGraph::Matrix6d::Zero();
+    A.topLeftCorner<3,3>() = T.linear();
+    A.topRightCorner<3,3>() = skew(T.translation())*T.linear();
+    A.bottomRightCorner<3,3>() = T.linear();
+    return A;
+}
+
+// Inverse of a covariance or information matrix that may be badly conditioned
+static PoseGraph::Matrix6d invertSym(const PoseGraph::Matrix6d& M){
+    PoseGraph::Matrix6d S = 0.5*(M+M.transpose());
+    S.diagonal().array() += 1e-12 + 1e-9*S.diagonal().maxCoeff();
+    PoseGraph::Matrix6d I = S.ldlt().solve(PoseGraph::Matrix6d::Identity());
+    return 0.5*(I+I.transpose());
+}
+
+
+
+PoseGraph::PoseGraph():
+    iterations(20){
+}
+
+
+
+void PoseGraph::setEdge(const int a, const int b, const Pose& relative, const Matrix6d& information){
+    ROS_ASSERT(a!=b);
+    // The reversed edge has the inverse error, so the same information
+    Edge& e = a<b ? edges[EdgeKey(a,b)] : edges[EdgeKey(b,a)];
+    e.relative = a<b ? relative : relative.inverse();
+    e.information = information;
+}
+
+
+
+bool PoseGraph::getEdge(const int a, const int b, Edge& e) const {
+    EdgeMap::const_iterator it = edges.find(a<b ? EdgeKey(a,b) : EdgeKey(b,a));
+    if (it == edges.end()){
+        return false;
+    }
+    e = it->second;
+    if (a>b){
+        e.relative = e.relative.inverse();
+    }
+    return true;
+}
+
+
+
+PoseGraph::Matrix6d PoseGraph::relativeInformation(const Pose& Ta, const Pose& Tb, const Matrix6d& Caa, const Matrix6d& Cbb, const Matrix6d& Cab){
+    // M = Ta^-1*Tb perturbed: exp(-da)*M*exp(db) = M*exp(db - K*da)
+    const Matrix6d K = adjoint((Ta.inverse()*Tb).inverse());
+    const Matrix6d Cm = Cbb + K*Caa*K.transpose() - Cab.transpose()*K.transpose() - K*Cab;
+
+    // EdgePosePose error: translation and quaternion vector part of Ta*M*Tb^-1 = exp(Ad(Tb)*dm)
+    Matrix6d J = adjoint(Tb);
+    J.bottomRows<3>() *= 0.5;
+    return invertSym(J*Cm*J.transpose());
+}
+
+
+
+void PoseGraph::removeKF(const int kfId, const int prevId, const int nextId){
+    Edge e1, e2, e3;
+    if (prevId>=0 && nextId>=0 && getEdge(prevId, kfId, e1) && getEdge(kfId, nextId, e2) && !getEdge(prevId, nextId, e3)){
+        // Compose, the uncertainties add up (ignoring the change of error coordinates)
+        setEdge(prevId, nextId, e1.relative*e2.relative, invertSym(invertSym(e1.information) + invertSym(e2.information)));
+        ROS_INFO("PGO = Bridged removed KF [%d] with an edge [%d] -> [%d]", kfId, prevId, nextId);
+    }
+    for (EdgeMap::iterator it = edges.begin(); it != edges.end();){
+        if (it->first.first==kfId || it->first.second==kfId){
+            edges.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+
+
+void PoseGraph::reset(){
+    edges.clear();
+}
+
+
+
+int PoseGraph::optimize(KFs& kfs){
+    ros::WallTime t0 = ros::WallTime::now();
+    std::map<int, uint> kfInd;
+    for (uint i=0; i<kfs.size(); ++i){
+        kfInd[kfs[i].kfId] = i;
+    }
+
+    /// Edges between the given keyframes with at least one free end
+    std::vector<EdgeMap::const_iterator> used;
+    std::set<uint> vertices;
+    for (EdgeMap::const_iterator it = edges.begin(); it != edges.end(); ++it){
+        std::map<int, uint>::const_iterator a = kfInd.find(it->first.first);
+        std::map<int, uint>::const_iterator b = kfInd.find(it->first.second);
+        if (a == kfInd.end() || b == kfInd.end() || (kfs[a->second].fixed && kfs[b->second].fixed)){
+            continue;
+        }
+        used.push_back(it);
+        vertices.insert(a->second);
+        vertices.insert(b->second);
+    }
+    if (used.empty()){
+        ROS_INFO("PGO = Nothing to optimise");
+        return 0;
+    }
+
+    /// Small pose only graph
+    g2o::SparseOptimizer optimizer;
+    g2o::BlockSolver_6_3::LinearSolverType* linearSolver = new g2o::LinearSolverDense<g2o::BlockSolver_6_3::PoseMatrixType>();
+    g2o::BlockSolver_6_3* solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
+    optimizer.setAlgorithm(new g2o::OptimizationAlgorithmLevenberg(solver_ptr));
+
+    std::map<int, VertexPose*> poses;
+    bool anyFixed = false;
+    for (std::set<uint>::const_iterator it = vertices.begin(); it != vertices.end(); ++it){
+        anyFixed = anyFixed || kfs[*it].fixed;
+    }
+    for (std::set<uint>::const_iterator it = vertices.begin(); it != vertices.end(); ++it){
+        const BAProblem::KF& kf = kfs[*it];
+        VertexPose* v = new VertexPose();
+        v->setId(kf.kfId);
+        // fix the gauge on the oldest keyframe if nothing else is fixed
+        v->setFixed(kf.fixed || (!anyFixed && it==vertices.begin()));
+        v->setEstimate(Eigen::Isometry3d(kf.pose.matrix()));
+        optimizer.addVertex(v);
+        poses[kf.kfId] = v;
+    }
+    for (uint i=0; i<used.size(); ++i){
+        EdgePosePose* e = new EdgePosePose();
+        e->setVertex(0, poses[used[i]->first.first]);
+        e->setVertex(1, poses[used[i]->first.second]);
+        e->setMeasurement(Eigen::Isometry3d(used[i]->second.relative.matrix()));
+        e->setInformation(used[i]->second.information);
+        optimizer.addEdge(e);
+    }
+
+    optimizer.initializeOptimization();
+    optimizer.computeActiveErrors();
+    const double chiStart = optimizer.activeChi2();
+    const int iter = optimizer.optimize(iterations);
+
+    for (std::set<uint>::const_iterator it = vertices.begin(); it != vertices.end(); ++it){
+        kfs[*it].pose = poses[kfs[*it].kfId]->estimate();
+    }
+    ROS_INFO("PGO = Optimised [%lu] keyframes over [%lu/%lu] edges in [%d] iterations. Chi2 [%g] -> [%g] [%.1fms]",
+             vertices.size(), used.size(), edges.size(), iter, chiStart, optimizer.activeChi2(), (ros::WallTime::now()-t0).toSec()*1000.);
+    optimizer.clear();
+    return iter;
+}
+
+
+
+void PoseGraph::setParameter(ollieRosTools::VoNode_paramsConfig &config, uint32_t level){
+    iterations = config.pg_iterations;
+}
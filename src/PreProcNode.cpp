@@ -21,9 +21,10 @@ namespace enc = sensor_msgs::image_encodings;
 
 
 /// Initialise ROS Node
-PreProcNode::PreProcNode(ros::NodeHandle& _n):
+PreProcNode::PreProcNode(ros::NodeHandle& _n, const ros::NodeHandle& _pn):
     n(_n),
     imTransport(_n),
+    srv(_pn),
     timeAlpha(0.95),
     timeAvg(0){
 
@@ -136,7 +137,8 @@ void PreProcNode::incomingImage(const sensor_msgs::ImageConstPtr& msg){
 
         sensor_msgs::CameraInfoPtr infoMsgPtr = camModel.getCamInfo();
 
-        /// Send out
+        /// Send out. Published as a shared pointer, so subscribers within the same nodelet manager receive it without
+        /// serialisation. The message must not be modified after publishing
         cv_bridge::CvImage cvi;
         cvi.header.stamp = msg->header.stamp;
         cvi.header.seq = msg->header.seq;
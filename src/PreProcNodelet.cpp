@@ -0,0 +1,27 @@
+/****************************************************
+  Nodelet wrapper around PreProcNode. Loaded into the same nodelet manager as the
+  VoNodelet, images are passed as shared pointers instead of being serialised
+  and copied over the loopback.
+  ****************************************************/
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include <boost/shared_ptr.hpp>
+#include <ollieRosTools/PreProcNode.hpp>
+
+
+class PreProcNodelet : public nodelet::Nodelet {
+    public:
+        PreProcNodelet(){}
+
+    private:
+        boost::shared_ptr<PreProcNode> node;
+
+        virtual void onInit(){
+            NODELET_INFO("Initialising PreProcNodelet");
+            // public handle for topics (so "image" can be remapped), private one for dynamic reconfigure
+            node.reset(new PreProcNode(getNodeHandle(), getPrivateNodeHandle()));
+        }
+};
+
+PLUGINLIB_EXPORT_CLASS(PreProcNodelet, nodelet::Nodelet)
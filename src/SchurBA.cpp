@@ -0,0 +1,524 @@
+#include <ollieRosTools/SchurBA.hpp>
+#include <algorithm>
+#include <cmath>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+SchurBA::SchurBA():
+    huber(false),
+    nrFree(0){
+}
+
+
+
+void SchurBA::setup(const BAProblem& p){
+    huber = p.huber;
+
+    /// Cameras
+    const uint nrCams = p.kfs.size();
+    std::map<int, uint> kfInd;
+    R.resize(nrCams);
+    t.resize(nrCams);
+    camFree.resize(nrCams);
+    nrFree = 0;
+    for (uint i=0; i<nrCams; ++i){
+        kfInd[p.kfs[i].kfId] = i;
+        R[i] = p.kfs[i].pose.linear();
+        t[i] = p.kfs[i].pose.translation();
+        camFree[i] = p.kfs[i].fixed ? -1 : nrFree++;
+    }
+
+    /// Landmarks
+    const uint nrLms = p.lms.size();
+    std::map<int, uint> lmInd;
+    X.resize(nrLms);
+    for (uint j=0; j<nrLms; ++j){
+        lmInd[p.lms[j].id] = j;
+        X[j] = p.lms[j].position;
+    }
+
+    /// Observations, counting sort by landmark
+    const uint nrObs = p.obs.size();
+    lmStart.assign(nrLms+1, 0);
+    Ints obsLmUnsorted(nrObs);
+    for (uint k=0; k<nrObs; ++k){
+        obsLmUnsorted[k] = lmInd[p.obs[k].lmId];
+        ++lmStart[obsLmUnsorted[k]+1];
+    }
+    for (uint j=0; j<nrLms; ++j){
+        lmStart[j+1] += lmStart[j];
+    }
+    Ints fill(lmStart.begin(), lmStart.end()-1);
+    obsCam.resize(nrObs);
+    obsLm.resize(nrObs);
+    meas.resize(nrObs);
+    obsIdx.resize(nrObs);
+    obsOut.assign(nrObs, 0);
+    obsBehind.assign(nrObs, 0);
+    for (uint k=0; k<nrObs; ++k){
+        const int o = fill[obsLmUnsorted[k]]++;
+        obsCam[o] = kfInd[p.obs[k].kfId];
+        obsLm[o]  = obsLmUnsorted[k];
+        meas[o]   = p.obs[k].measurement;
+        obsIdx[o] = k;
+    }
+
+    U.resize(nrCams);
+    gc.resize(nrCams);
+    dc.resize(nrCams);
+    V.resize(nrLms);
+    gl.resize(nrLms);
+    Vinv.resize(nrLms);
+    dl.resize(nrLms);
+    W.resize(nrObs);
+}
+
+
+
+double SchurBA::robust(const double e2) const {
+    // same as g2o::RobustKernelHuber with delta 1
+    if (!huber || e2<=1.0){
+        return e2;
+    }
+    return 2.0*std::sqrt(e2) - 1.0;
+}
+
+double SchurBA::robustWeight(const double e2) const {
+    if (!huber || e2<=1.0){
+        return 1.0;
+    }
+    return 1.0/std::sqrt(e2);
+}
+
+
+
+double SchurBA::error2(const uint k) const {
+    const uint c = obsCam[k];
+    const Eigen::Vector3d P = R[c].transpose()*(X[obsLm[k]]-t[c]);
+    if (P[2]<1e-9){
+        return -1;
+    }
+    return (meas[k] - Eigen::Vector2d(P[0]/P[2], P[1]/P[2])).squaredNorm();
+}
+
+
+
+bool SchurBA::evaluate(const uint k, Eigen::Vector2d& e, Eigen::Matrix<double, 2, 6>& Jc, Eigen::Matrix<double, 2, 3>& Jl, double& w) const {
+    if (obsOut[k]){
+        return false;
+    }
+    const uint c = obsCam[k];
+    const Eigen::Matrix3d Rt = R[c].transpose();
+    const Eigen::Vector3d P = Rt*(X[obsLm[k]]-t[c]);
+    if (P[2]<1e-9){
+        return false;
+    }
+    const double zinv = 1.0/P[2];
+    e = meas[k] - Eigen::Vector2d(P[0]*zinv, P[1]*zinv);
+    w = robustWeight(e.squaredNorm());
+
+    // d(e)/d(P)
+    Eigen::Matrix<double, 2, 3> A;
+    A << -zinv,     0, P[0]*zinv*zinv,
+             0, -zinv, P[1]*zinv*zinv;
+
+    // t += R*dt, R = R*exp(dw) => P -= dt + dw x P
+    Eigen::Matrix3d Px;
+    Px <<     0, -P[2],  P[1],
+           P[2],     0, -P[0],
+          -P[1],  P[0],     0;
+    Jc.leftCols<3>()  = -A;
+    Jc.rightCols<3>() = A*Px;
+    Jl = A*Rt;
+    return true;
+}
+
+
+
+double SchurBA::cost() const {
+    double chi2 = 0;
+    const int nrObs = obsCam.size();
+    #ifdef _OPENMP
+    #pragma omp parallel for reduction(+:chi2) schedule(static)
+    #endif
+    for (int k=0; k<nrObs; ++k){
+        if (obsOut[k]){
+            continue;
+        }
+        const double e2 = error2(k);
+        if (e2>=0){
+            chi2 += robust(e2);
+        }
+    }
+    return chi2;
+}
+
+
+
+void SchurBA::updateBehind(){
+    const int nrObs = obsCam.size();
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+    #endif
+    for (int k=0; k<nrObs; ++k){
+        obsBehind[k] = error2(k)<0;
+    }
+}
+
+
+
+uint SchurBA::movedBehind() const {
+    uint nr = 0;
+    const int nrObs = obsCam.size();
+    #ifdef _OPENMP
+    #pragma omp parallel for reduction(+:nr) schedule(static)
+    #endif
+    for (int k=0; k<nrObs; ++k){
+        if (!obsOut[k] && !obsBehind[k] && error2(k)<0){
+            ++nr;
+        }
+    }
+    return nr;
+}
+
+
+
+void SchurBA::linearise(){
+    const uint nrCams = R.size();
+    const int nrLms = X.size();
+    for (uint i=0; i<nrCams; ++i){
+        U[i].setZero();
+        gc[i].setZero();
+    }
+
+    #ifdef _OPENMP
+    #pragma omp parallel
+    #endif
+    {
+        // per thread camera blocks
+        Mat66s Ul(nrCams, Mat66::Zero());
+        Vec6s gcl(nrCams, Vec6::Zero());
+        Eigen::Vector2d e;
+        Eigen::Matrix<double, 2, 6> Jc;
+        Eigen::Matrix<double, 2, 3> Jl;
+        double w;
+
+        #ifdef _OPENMP
+        #pragma omp for schedule(dynamic, 64)
+        #endif
+        for (int j=0; j<nrLms; ++j){
+            V[j].setZero();
+            gl[j].setZero();
+            for (int k=lmStart[j]; k<lmStart[j+1]; ++k){
+                if (!evaluate(k, e, Jc, Jl, w)){
+                    W[k].setZero();
+                    continue;
+                }
+                const uint c = obsCam[k];
+                V[j].noalias()  += w*Jl.transpose()*Jl;
+                gl[j].noalias() += w*Jl.transpose()*e;
+                W[k].noalias()  =  w*Jc.transpose()*Jl;
+                Ul[c].noalias()  += w*Jc.transpose()*Jc;
+                gcl[c].noalias() += w*Jc.transpose()*e;
+            }
+        }
+
+        #ifdef _OPENMP
+        #pragma omp critical(SchurBALinearise)
+        #endif
+        for (uint i=0; i<nrCams; ++i){
+            U[i] += Ul[i];
+            gc[i] += gcl[i];
+        }
+    }
+}
+
+
+
+void SchurBA::reduce(const double lambda){
+    const uint nrCams = R.size();
+    const int nrLms = X.size();
+    const int n = 6*nrFree;
+    S.setZero(n, n);
+    b.setZero(n);
+
+    /// Damped camera blocks
+    for (uint i=0; i<nrCams; ++i){
+        const int a = camFree[i];
+        if (a<0){
+            continue;
+        }
+        S.block<6,6>(6*a, 6*a) = U[i];
+        S.block<6,6>(6*a, 6*a).diagonal() += lambda*U[i].diagonal();
+        b.segment<6>(6*a) = -gc[i];
+    }
+
+    /// Eliminate landmarks: S -= W Vinv W', b += W Vinv gl
+    #ifdef _OPENMP
+    #pragma omp parallel
+    #endif
+    {
+        Eigen::MatrixXd Sl = Eigen::MatrixXd::Zero(n, n);
+        Eigen::VectorXd bl = Eigen::VectorXd::Zero(n);
+
+        #ifdef _OPENMP
+        #pragma omp for schedule(dynamic, 64)
+        #endif
+        for (int j=0; j<nrLms; ++j){
+            Eigen::Matrix3d Vd = V[j];
+            Vd.diagonal() += lambda*V[j].diagonal() + Eigen::Vector3d::Constant(1e-12);
+            Vinv[j] = Vd.inverse();
+            const Eigen::Vector3d Vg = Vinv[j]*gl[j];
+            for (int k=lmStart[j]; k<lmStart[j+1]; ++k){
+                const int a = camFree[obsCam[k]];
+                if (a<0){
+                    continue;
+                }
+                const Mat63 WV = W[k]*Vinv[j];
+                bl.segment<6>(6*a).noalias() += W[k]*Vg;
+                for (int l=lmStart[j]; l<lmStart[j+1]; ++l){
+                    const int c = camFree[obsCam[l]];
+                    if (c<a){
+                        continue;
+                    }
+                    Sl.block<6,6>(6*a, 6*c).noalias() -= WV*W[l].transpose();
+                }
+            }
+        }
+
+        #ifdef _OPENMP
+        #pragma omp critical(SchurBASchur)
+        #endif
+        {
+            S += Sl;
+            b += bl;
+        }
+    }
+}
+
+
+
+bool SchurBA::solveStep(const double lambda){
+    const uint nrCams = R.size();
+    const int nrLms = X.size();
+    const int n = 6*nrFree;
+    reduce(lambda);
+
+    /// Solve the reduced camera system, only the upper triangle was filled
+    if (n>0){
+        const Eigen::LDLT<Eigen::MatrixXd> ldlt(S.selfadjointView<Eigen::Upper>());
+        if (ldlt.info()!=Eigen::Success){
+            return false;
+        }
+        const Eigen::VectorXd x = ldlt.solve(b);
+        if (!x.allFinite()){
+            return false;
+        }
+        for (uint i=0; i<nrCams; ++i){
+            dc[i] = camFree[i]<0 ? Vec6::Zero() : Vec6(x.segment<6>(6*camFree[i]));
+        }
+    } else {
+        for (uint i=0; i<nrCams; ++i){
+            dc[i].setZero();
+        }
+    }
+
+    /// Back substitute the landmarks
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 64)
+    #endif
+    for (int j=0; j<nrLms; ++j){
+        Eigen::Vector3d r = -gl[j];
+        for (int k=lmStart[j]; k<lmStart[j+1]; ++k){
+            r.noalias() -= W[k].transpose()*dc[obsCam[k]];
+        }
+        dl[j] = Vinv[j]*r;
+    }
+    return true;
+}
+
+
+
+int SchurBA::iterate(const int maxIter, const double gainThresh, const double budget, const ros::WallTime& tStart, double& chi, const char*& reason){
+    double lambda = -1;
+    double nu = 2;
+    int iter = 0;
+    reason = "max iterations";
+    updateBehind();
+
+    for (; iter<maxIter; ++iter){
+        linearise();
+
+        // Initial damping relative to the largest diagonal entry, as g2o does
+        if (lambda<0){
+            double maxDiag = 0;
+            for (uint i=0; i<U.size(); ++i){
+                if (camFree[i]>=0){
+                    maxDiag = std::max(maxDiag, U[i].diagonal().maxCoeff());
+                }
+            }
+            for (uint j=0; j<V.size(); ++j){
+                maxDiag = std::max(maxDiag, V[j].diagonal().maxCoeff());
+            }
+            lambda = 1e-5*std::max(maxDiag, 1e-12);
+        }
+
+        bool accepted = false;
+        double chiNew = chi;
+        for (int tries=0; tries<10 && !accepted; ++tries){
+            if (!solveStep(lambda)){
+                lambda *= nu;
+                nu *= 2;
+                continue;
+            }
+
+            Rold = R;
+            told = t;
+            Xold = X;
+            for (uint i=0; i<R.size(); ++i){
+                if (camFree[i]<0){
+                    continue;
+                }
+                t[i] += R[i]*dc[i].head<3>();
+                const double angle = dc[i].tail<3>().norm();
+                if (angle>1e-12){
+                    R[i] = R[i]*Eigen::AngleAxisd(angle, dc[i].tail<3>()/angle).toRotationMatrix();
+                }
+            }
+            for (uint j=0; j<X.size(); ++j){
+                X[j] += dl[j];
+            }
+
+            // Points behind a camera drop out of the cost, so a step could lower it by pushing badly fitting points
+            // there. g2o keeps penalising them, reject such steps instead
+            const bool behind = movedBehind()>0;
+            chiNew = behind ? chi : cost();
+            if (!behind && chiNew<chi){
+                accepted = true;
+                updateBehind();
+                lambda = std::max(lambda/3., 1e-12);
+                nu = 2;
+            } else {
+                std::swap(R, Rold);
+                std::swap(t, told);
+                std::swap(X, Xold);
+                lambda *= nu;
+                nu *= 2;
+            }
+        }
+
+        if (!accepted){
+            reason = "no more progress";
+            break;
+        }
+
+        const double gain = (chi-chiNew)/std::max(chiNew, 1e-300);
+        chi = chiNew;
+        if (gainThresh>0 && gain<gainThresh){
+            ++iter;
+            reason = "converged";
+            break;
+        }
+        if (budget>0 && (ros::WallTime::now()-tStart).toSec()>budget){
+            ++iter;
+            reason = "time budget";
+            break;
+        }
+    }
+    return iter;
+}
+
+
+
+int SchurBA::solve(BAProblem& p){
+    ROS_INFO("SBA > Doing Schur BA with [%lu] KeyFrames, [%lu] LandMarks and [%lu] observations", p.kfs.size(), p.lms.size(), p.obs.size());
+    ros::WallTime tStart = ros::WallTime::now();
+
+    setup(p);
+    ros::WallTime tSetup = ros::WallTime::now();
+
+    double chi = cost();
+    const double chiStart = chi;
+    const char* reason;
+    int iter = iterate(p.iter, p.gain, p.budget, tStart, chi, reason);
+    ros::WallTime tOpt = ros::WallTime::now();
+
+    /// Cull observations with a large error (or behind the camera) and re-optimise briefly without them
+    p.outliers.assign(p.obs.size(), false);
+    p.nrOutliers = 0;
+    if (p.outlierChi2>0){
+        for (uint k=0; k<obsCam.size(); ++k){
+            const double e2 = error2(k);
+            if (e2<0 || e2>p.outlierChi2){
+                obsOut[k] = 1;
+                p.outliers[obsIdx[k]] = true;
+                ++p.nrOutliers;
+            }
+        }
+        if (p.nrOutliers>0 && p.outlierIter>0){
+            chi = cost();
+            const char* reasonOut;
+            iter += iterate(p.outlierIter, 0, 0, tStart, chi, reasonOut);
+        }
+        ROS_INFO("SBA = Culled [%u/%lu] outlier observations [%.1fms]", p.nrOutliers, p.obs.size(), (ros::WallTime::now()-tOpt).toSec()*1000.);
+    }
+    ros::WallTime tCull = ros::WallTime::now();
+
+    /// Read back results
+    for (uint i=0; i<p.kfs.size(); ++i){
+        p.kfs[i].pose.linear() = R[i];
+        p.kfs[i].pose.translation() = t[i];
+    }
+    for (uint j=0; j<p.lms.size(); ++j){
+        p.lms[j].position = X[j];
+    }
+
+    p.time = (ros::WallTime::now()-tStart).toSec();
+    p.iterations = iter;
+    p.chi2 = chi;
+    ROS_INFO("SBA < Stopped after [%d/%d] iterations: %s. Chi2 [%g] -> [%g]", iter, p.iter, reason, chiStart, chi);
+    ROS_INFO("SBA < Done BA [Setup: %.1fms] [Opti: %.1fms] [Cull: %.1fms] [Total: %.1fms]", (tSetup-tStart).toSec()*1000., (tOpt-tSetup).toSec()*1000., (tCull-tOpt).toSec()*1000., p.time*1000.);
+    return iter;
+}
+
+
+
+bool SchurBA::marginals(BAProblem& p){
+    ros::WallTime t0 = ros::WallTime::now();
+    p.poseCov.resize(0, 0);
+    p.poseCovInd.assign(p.kfs.size(), -1);
+
+    setup(p);
+    for (uint k=0; k<obsIdx.size(); ++k){
+        if (!p.outliers.empty() && p.outliers[obsIdx[k]]){
+            obsOut[k] = 1;
+        }
+    }
+    linearise();
+    reduce(0);
+    const int n = 6*nrFree;
+    if (n==0){
+        return false;
+    }
+
+    // The scale (and with no fixed keyframe the whole gauge) is not observable, a tiny prior keeps S invertible
+    Eigen::MatrixXd H = S.selfadjointView<Eigen::Upper>();
+    H.diagonal().array() += 1e-9*H.diagonal().maxCoeff() + 1e-12;
+    const Eigen::LDLT<Eigen::MatrixXd> ldlt(H);
+    if (ldlt.info()!=Eigen::Success){
+        ROS_WARN("SBA = Could not factorise the reduced camera system for the marginals");
+        return false;
+    }
+    p.poseCov = ldlt.solve(Eigen::MatrixXd::Identity(n, n));
+    if (!p.poseCov.allFinite()){
+        p.poseCov.resize(0, 0);
+        return false;
+    }
+    for (uint i=0; i<p.kfs.size(); ++i){
+        p.poseCovInd[i] = camFree[i];
+    }
+    ROS_INFO("SBA = Computed marginal covariance of [%u] keyframe poses in [%.1fms]", nrFree, (ros::WallTime::now()-t0).toSec()*1000.);
+    return true;
+}
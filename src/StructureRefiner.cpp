@@ -0,0 +1,202 @@
+#include <ollieRosTools/StructureRefiner.hpp>
+#include <cmath>
+#include <map>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+StructureRefiner::StructureRefiner():
+    iterations(5),
+    huber(true){
+    k2 = OVO::px2tangentSq(3);
+}
+
+
+
+bool StructureRefiner::cost(const uint j, const Eigen::Vector3d& x, double& chi2) const {
+    chi2 = 0;
+    for (int k=obsStart[j]; k<obsStart[j+1]; ++k){
+        const Eigen::Vector3d u = (Rt[k]*(x-t[k])).normalized();
+        if (u.dot(bv[k])<=0){
+            return false;
+        }
+        const double e2 = (basis[k]*u).squaredNorm();
+        chi2 += (!huber || e2<=k2) ? e2 : 2.0*std::sqrt(e2*k2)-k2;
+    }
+    return true;
+}
+
+
+
+void StructureRefiner::clear(const uint nrLms){
+    obsStart.assign(1, 0);
+    Rt.clear();
+    t.clear();
+    bv.clear();
+    basis.clear();
+    X.resize(nrLms);
+    moved.assign(nrLms, false);
+}
+
+
+
+void StructureRefiner::addObservation(const Pose& pose, const Eigen::Vector3d& f){
+    Rt.push_back(pose.linear().transpose());
+    t.push_back(pose.translation());
+    bv.push_back(f);
+    basis.push_back(OVO::tangentBasis(f));
+}
+
+
+
+void StructureRefiner::solve(){
+    const int nrLms = X.size();
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 32)
+    #endif
+    for (int j=0; j<nrLms; ++j){
+        if (obsStart[j+1]-obsStart[j]<2){
+            continue;
+        }
+        double chi2;
+        if (!cost(j, X[j], chi2)){
+            continue;
+        }
+        for (int it=0; it<iterations; ++it){
+            Eigen::Matrix3d H = Eigen::Matrix3d::Zero();
+            Eigen::Vector3d g = Eigen::Vector3d::Zero();
+            for (int k=obsStart[j]; k<obsStart[j+1]; ++k){
+                const Eigen::Vector3d P = Rt[k]*(X[j]-t[k]);
+                const double norm = P.norm();
+                const Eigen::Vector3d u = P/norm;
+                const Eigen::Vector2d e = basis[k]*u;
+                const double e2 = e.squaredNorm();
+                const double w = (!huber || e2<=k2) ? 1.0 : std::sqrt(k2/e2);
+                const Eigen::Matrix<double, 2, 3> J = basis[k]*(Eigen::Matrix3d::Identity()-u*u.transpose())*Rt[k]/norm;
+                H.noalias() += w*J.transpose()*J;
+                g.noalias() += w*J.transpose()*e;
+            }
+
+            // Rays (nearly) parallel, depth is not observable
+            Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> es;
+            es.computeDirect(H, Eigen::EigenvaluesOnly);
+            if (es.eigenvalues()[0] < 1e-6*es.eigenvalues()[2]){
+                break;
+            }
+
+            const Eigen::Vector3d x = X[j] - H.ldlt().solve(g);
+            double chi2New;
+            if (!x.allFinite() || !cost(j, x, chi2New) || chi2New>=chi2){
+                break;
+            }
+            const bool converged = (x-X[j]).squaredNorm() < 1e-16*(1.0+X[j].squaredNorm());
+            X[j] = x;
+            chi2 = chi2New;
+            moved[j] = true;
+            if (converged){
+                break;
+            }
+        }
+    }
+}
+
+
+
+uint StructureRefiner::refine(const Landmark::Ptrs& lms){
+    ros::WallTime t0 = ros::WallTime::now();
+    const int nrLms = lms.size();
+
+    /// Gather observations
+    clear(nrLms);
+    for (int j=0; j<nrLms; ++j){
+        const Landmark::Ptr& lm = lms[j];
+        X[j] = lm->getPosition();
+        const uint obsNr = lm->getObservationsNr();
+        // a single ray cannot fix a point
+        if (obsNr>=2){
+            for (uint i=0; i<obsNr; ++i){
+                addObservation(lm->getObservationFrame(i)->getPose(), lm->getObservationBearing(i).normalized());
+            }
+        }
+        obsStart.push_back(Rt.size());
+    }
+    ros::WallTime tGather = ros::WallTime::now();
+
+    solve();
+    ros::WallTime tSolve = ros::WallTime::now();
+
+
+    /// Write back
+    uint nrMoved = 0;
+    for (int j=0; j<nrLms; ++j){
+        if (moved[j]){
+            lms[j]->setPosition(X[j]);
+            ++nrMoved;
+        }
+    }
+
+    ROS_INFO("STR = Structure only refinement moved [%u/%d] landmarks with [%lu] observations [Gather: %.1fms] [Solve: %.1fms] [Total: %.1fms]",
+             nrMoved, nrLms, Rt.size(), (tGather-t0).toSec()*1000., (tSolve-tGather).toSec()*1000., (ros::WallTime::now()-t0).toSec()*1000.);
+    return nrMoved;
+}
+
+
+
+uint StructureRefiner::refine(BAProblem& p){
+    ros::WallTime t0 = ros::WallTime::now();
+    const int nrLms = p.lms.size();
+
+    /// Group the observations by landmark
+    std::map<int, uint> kfInd;
+    for (uint i=0; i<p.kfs.size(); ++i){
+        kfInd[p.kfs[i].kfId] = i;
+    }
+    std::map<int, uint> lmInd;
+    for (int j=0; j<nrLms; ++j){
+        lmInd[p.lms[j].id] = j;
+    }
+    std::vector<Ints> lmObs(nrLms);
+    for (uint k=0; k<p.obs.size(); ++k){
+        lmObs[lmInd[p.obs[k].lmId]].push_back(k);
+    }
+
+    /// Gather observations
+    clear(nrLms);
+    for (int j=0; j<nrLms; ++j){
+        X[j] = p.lms[j].position;
+        // a single ray cannot fix a point
+        if (lmObs[j].size()>=2){
+            for (uint i=0; i<lmObs[j].size(); ++i){
+                const BAProblem::Obs& o = p.obs[lmObs[j][i]];
+                // image plane at depth 1 -> bearing
+                addObservation(p.kfs[kfInd[o.kfId]].pose, Eigen::Vector3d(o.measurement[0], o.measurement[1], 1.0).normalized());
+            }
+        }
+        obsStart.push_back(Rt.size());
+    }
+    ros::WallTime tGather = ros::WallTime::now();
+
+    solve();
+
+    /// Write back
+    uint nrMoved = 0;
+    for (int j=0; j<nrLms; ++j){
+        if (moved[j]){
+            p.lms[j].position = X[j];
+            ++nrMoved;
+        }
+    }
+
+    ROS_INFO("STR = Structure only refinement of the BA snapshot moved [%u/%d] landmarks with [%lu] observations [Gather: %.1fms] [Total: %.1fms]",
+             nrMoved, nrLms, Rt.size(), (tGather-t0).toSec()*1000., (ros::WallTime::now()-t0).toSec()*1000.);
+    return nrMoved;
+}
+
+
+
+void StructureRefiner::setParameter(ollieRosTools::VoNode_paramsConfig &config, uint32_t level){
+    iterations = config.map_refineIter;
+    huber      = config.g2o_huber;
+    k2 = OVO::px2tangentSq(config.map_refineThresh);
+}
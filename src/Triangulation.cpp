@@ -0,0 +1,105 @@
+#include <ollieRosTools/Triangulation.hpp>
+#include <cmath>
+
+
+void OVO::bearings2SoA(const Bearings& bv, BearingsSoA& bvSoA){
+    bvSoA.resize(bv.size(), 3);
+    for (uint i=0; i<bv.size(); ++i){
+        bvSoA.row(i) = bv[i].transpose();
+    }
+}
+
+
+
+void OVO::triangulateBatch(const Pose& trans1to2, const BearingsSoA& bv1, const BearingsSoA& bv2,
+                           Points3d& points, Bools& valid,
+                           const TRIANGULATION_METHOD method,
+                           const double minParallaxDeg,
+                           const double maxError){
+    ROS_ASSERT(bv1.rows() == bv2.rows());
+    typedef Eigen::ArrayXd Arr;
+    const int n = bv1.rows();
+    const Eigen::Vector3d t = trans1to2.translation();
+
+    // Second bearings rotated into frame 1
+    const BearingsSoA f2 = bv2 * trans1to2.linear().transpose();
+    const Arr x1 = bv1.col(0), y1 = bv1.col(1), z1 = bv1.col(2);
+    const Arr x2 = f2.col(0),  y2 = f2.col(1),  z2 = f2.col(2);
+
+    /// Midpoint: depths l1, l2 along both rays minimising |l1*f1 - (t + l2*f2)|
+    const Arr a = x1*x1 + y1*y1 + z1*z1;
+    const Arr b = x1*x2 + y1*y2 + z1*z2;
+    const Arr c = x2*x2 + y2*y2 + z2*z2;
+    const Arr d = x1*t[0] + y1*t[1] + z1*t[2];
+    const Arr e = x2*t[0] + y2*t[1] + z2*t[2];
+    const Arr denom = a*c - b*b;
+    const Arr l1 = (c*d - b*e)/denom;
+    const Arr l2 = (b*d - a*e)/denom;
+
+    // Rays that are (nearly) parallel cannot be triangulated. Checked explicitly, we are compiled with -ffast-math so nan checks do not work
+    Eigen::Array<bool, Eigen::Dynamic, 1> ok = denom > 1e-12;
+
+    Arr px = 0.5*(l1*x1 + t[0] + l2*x2);
+    Arr py = 0.5*(l1*y1 + t[1] + l2*y2);
+    Arr pz = 0.5*(l1*z1 + t[2] + l2*z2);
+
+    if (method == TRI_LINEAR){
+        /// Minimise sum_i w_i |(I-u_i*u_i')(X-c_i)|^2 with w_i = 1/depth_i^2, ie the squared angular error,
+        /// using the midpoint depths. Normal equations A*X = r solved in closed form (A is symmetric 3x3)
+        const Arr w1 = 1.0/(l1*l1*a).max(1e-12);
+        const Arr w2 = 1.0/(l2*l2*c).max(1e-12);
+        // P = I - uu'/|u|^2
+        const Arr a00 = w1*(1.0 - x1*x1/a) + w2*(1.0 - x2*x2/c);
+        const Arr a11 = w1*(1.0 - y1*y1/a) + w2*(1.0 - y2*y2/c);
+        const Arr a22 = w1*(1.0 - z1*z1/a) + w2*(1.0 - z2*z2/c);
+        const Arr a01 = -w1*x1*y1/a - w2*x2*y2/c;
+        const Arr a02 = -w1*x1*z1/a - w2*x2*z2/c;
+        const Arr a12 = -w1*y1*z1/a - w2*y2*z2/c;
+        // r = w2*P2*t, camera 1 is at the origin
+        const Arr r0 = w2*(t[0] - x2*e/c);
+        const Arr r1 = w2*(t[1] - y2*e/c);
+        const Arr r2 = w2*(t[2] - z2*e/c);
+        // Inverse via cofactors
+        const Arr c00 = a11*a22 - a12*a12;
+        const Arr c01 = a02*a12 - a01*a22;
+        const Arr c02 = a01*a12 - a02*a11;
+        const Arr c11 = a00*a22 - a02*a02;
+        const Arr c12 = a01*a02 - a00*a12;
+        const Arr c22 = a00*a11 - a01*a01;
+        const Arr det = a00*c00 + a01*c01 + a02*c02;
+        // Relative to trace^3 so it does not depend on the weights (depth, ie the map scale). det/trace^3 ~ sin^2(parallax)/32,
+        // 1e-9 only rejects below ~0.01 deg, the parallax check below does the rest
+        const Arr trace = a00 + a11 + a22;
+        ok = ok && det > 1e-9*trace*trace*trace;
+        px = (c00*r0 + c01*r1 + c02*r2)/det;
+        py = (c01*r0 + c11*r1 + c12*r2)/det;
+        pz = (c02*r0 + c12*r1 + c22*r2)/det;
+    }
+
+    /// Validity
+    // Cheirality: depth along both rays
+    const Arr dx = px - t[0], dy = py - t[1], dz = pz - t[2];
+    const Arr depth1 = px*x1 + py*y1 + pz*z1;
+    const Arr depth2 = dx*x2 + dy*y2 + dz*z2;
+    ok = ok && (depth1 > 0) && (depth2 > 0);
+
+    // Parallax: cos of the angle between the rays
+    if (minParallaxDeg > 0){
+        ok = ok && (b/(a*c).sqrt() < std::cos(minParallaxDeg*toRad));
+    }
+
+    // Reprojection error 1-cos in both frames
+    if (maxError > 0){
+        const Arr norm1 = (px*px + py*py + pz*pz).sqrt() * a.sqrt();
+        const Arr norm2 = (dx*dx + dy*dy + dz*dz).sqrt() * c.sqrt();
+        ok = ok && (1.0 - depth1/norm1 < maxError) && (1.0 - depth2/norm2 < maxError);
+    }
+
+    /// Back to AoS for the rest of the pipeline
+    points.resize(n);
+    valid.resize(n);
+    for (int i=0; i<n; ++i){
+        points[i] = Point3d(px[i], py[i], pz[i]);
+        valid[i] = ok[i];
+    }
+}
@@ -20,11 +20,14 @@ VoNode::VoNode(ros::NodeHandle& _n):
     cameraModel(new CameraATAN()),
     detector(new Detector()),
     preproc(new PreProc()),
+    imageQuality(new ImageQuality()),
     n(_n),
     imTransport(_n),
+    srv(_n),
     timeAlpha(0.95),
     timeAvg(0),
-    imgDelay(0)
+    imgDelay(0),
+    imuMaxLate(0.05)
     {
     Frame::setCamera(cameraModel);
     Frame::setDetector(detector);
@@ -70,6 +73,7 @@ VoNode::VoNode(ros::NodeHandle& _n):
         n.param("imuFrame", IMU_FRAME, std::string("/cf_attitude"));
         n.param("worldFrame", WORLD_FRAME, std::string("/world"));
         n.param("camFrame", CAM_FRAME, std::string("/cam"));
+        n.param("imuTopic", imuTopic, std::string("/cf/imu"));
 
         ROS_INFO("Using <%s> as world frame",  WORLD_FRAME.c_str());
         ROS_INFO("Using <%s> as camera frame",  CAM_FRAME.c_str());
@@ -87,6 +91,10 @@ VoNode::VoNode(ros::NodeHandle& _n):
 
     if (USE_IMU){
         ROS_INFO("Using <%s> as imu frame", IMU_FRAME.c_str());
+        if (!USE_SYNTHETIC && imuTopic.length()>0){
+            ROS_INFO("Using <%s> as imu topic for attitude and angular rates", imuTopic.c_str());
+            subImu = n.subscribe(imuTopic, 100, &VoNode::incomingImu, this);
+        }
     } else {
         ROS_INFO("Not Using imu!");
     }
@@ -97,6 +105,7 @@ VoNode::VoNode(ros::NodeHandle& _n):
         ROS_INFO("Using <%s> as mask", maskPath.c_str());
         cv::Mat mask = cv::imread(maskPath, CV_LOAD_IMAGE_GRAYSCALE);
         Frame::setMask(mask);
+        imageQuality->setMask(mask);
         ROS_ASSERT_MSG(!mask.empty(), "Failed to load mask <%s>, incorrect path?", maskPath.c_str());
 
     } else {
@@ -143,6 +152,80 @@ void VoNode::initImu2Cam(){
 
 
 
+void VoNode::incomingImu(const sensor_msgs::ImuConstPtr& msg){
+    // Only this callback writes to the buffer, so it may also clear it
+    if (msg->header.stamp < lastImuTime){
+        ROS_WARN("NOD = Detected negative time jump, resetting IMU buffer");
+        imuBuffer.clear();
+    }
+    lastImuTime = msg->header.stamp;
+    if (msg->orientation_covariance[0] < 0){
+        // REP 145: no orientation estimate, keep the rates but make sure the attitude is not used
+        sensor_msgs::Imu m = *msg;
+        m.orientation.x = m.orientation.y = m.orientation.z = m.orientation.w = 0;
+        imuBuffer.push(m);
+    } else {
+        imuBuffer.push(*msg);
+    }
+}
+
+
+
+/// Gets the attitude of the IMU at time t as the transform IMU_FRAME <- WORLD_FRAME, ie what the TF lookup used to return.
+/// Never blocks. If the IMU data is late by no more than imuMaxLate we use the newest attitude.
+bool VoNode::getImuAttitude(const ros::Time& t, tf::StampedTransform& imuStamped){
+    if (subImu){
+        ImuSample s;
+        const ImuBuffer::Result r = imuBuffer.get(t.toSec(), imuMaxLate, s);
+        // a zero quaternion means the IMU publishes no orientation
+        if (r!=ImuBuffer::FAIL && s.q[0]*s.q[0] + s.q[1]*s.q[1] + s.q[2]*s.q[2] + s.q[3]*s.q[3] > 0.5){
+            if (r==ImuBuffer::HELD){
+                ROS_WARN_THROTTLE(1,"NOD = IMU data late, using the newest attitude");
+            }
+            // The IMU orientation is the pose of the IMU in the world frame, the same rotation the driver broadcasts as WORLD->IMU TF
+            const tf::Transform imu(tf::Quaternion(s.q[0], s.q[1], s.q[2], s.q[3]));
+            imuStamped = tf::StampedTransform(imu.inverse(), t, IMU_FRAME, WORLD_FRAME);
+            return true;
+        }
+        // Nothing (usable) published on the IMU topic, try TF as before
+        ROS_WARN_THROTTLE(5,"NOD = No IMU attitude on <%s> for the frame time, falling back to TF", imuTopic.c_str());
+    }
+
+    // No IMU topic or no data on it, fall back to TF but dont wait for it
+    try{
+        // sent out by the crazyflie driver driver.py
+        subTF.lookupTransform(IMU_FRAME, WORLD_FRAME, t, imuStamped);
+        return true;
+    } catch(tf::TransformException& ex){
+        try{
+            subTF.lookupTransform(IMU_FRAME, WORLD_FRAME, ros::Time(0), imuStamped);
+            if (t-imuStamped.stamp_ <= ros::Duration(imuMaxLate)){
+                ROS_WARN_THROTTLE(1,"NOD = IMU TF late, using the newest attitude");
+                return true;
+            }
+        } catch(tf::TransformException& ex2){
+        }
+        ROS_ERROR_THROTTLE(1,"TF exception. Could not get flie IMU transform: %s", ex.what());
+        return false;
+    }
+}
+
+
+
+/// Gets the IMU rates at time t. Returns false if there are none
+bool VoNode::getImuRates(const ros::Time& t, Eigen::Vector3d& gyro, Eigen::Vector3d& acc){
+    ImuSample s;
+    if (imuBuffer.get(t.toSec(), imuMaxLate, s)==ImuBuffer::FAIL){
+        return false;
+    }
+    gyro = s.getGyro();
+    acc  = s.getAcc();
+    return true;
+}
+
+
+
+
 void VoNode::incomingSynthetic(const ollieRosTools::synthFrameConstPtr& msg){
     ROS_INFO((std::string("\n")+OVO::colorise("============================================================================== FRAME %d ",OVO::FG_WHITE, OVO::BG_BLUE)).c_str(),msg->frameId);
 
@@ -168,12 +251,7 @@ void VoNode::incomingSynthetic(const ollieRosTools::synthFrameConstPtr& msg){
     tf::StampedTransform imuStamped;
 
     if (USE_IMU){
-        try{
-            // sent out by the crazyflie driver driver.py
-            subTF.waitForTransform(IMU_FRAME, WORLD_FRAME, msg->header.stamp-imgDelay, ros::Duration(0.1) );
-            subTF.lookupTransform(IMU_FRAME, WORLD_FRAME, msg->header.stamp-imgDelay, imuStamped);
-        } catch(tf::TransformException& ex){
-            ROS_ERROR_THROTTLE(1,"TF exception. Could not get flie IMU transform: %s", ex.what());
+        if (!getImuAttitude(msg->header.stamp-imgDelay, imuStamped)){
             return;
         }
     } else {
@@ -249,6 +327,30 @@ void VoNode::incomingImage(const sensor_msgs::ImageConstPtr& msg){
     }
     lastTime = msg->header.stamp;
 
+    /// Decide how much work we can afford on this frame
+    const FrameScheduler::Decision decision = scheduler.decide(msg->header.stamp, msg->header.seq);
+    if (decision==FrameScheduler::SKIP){
+        ROS_WARN("NOD = SKIPPING FRAME, NO TIME BUDGET [Age: %.1fms]", scheduler.getAge()*1000.);
+        scheduler.printStats();
+        return;
+    }
+
+    /// Predict motion blur from the gyros before touching the image
+    Eigen::Vector3d gyro(0,0,0), acc(0,0,0);
+    if (USE_IMU && getImuRates(msg->header.stamp-imgDelay, gyro, acc)){
+        // blur is predicted on the raw image, not the rectified one
+        blurPredictor.predict(gyro, cameraModel->getRawFocal(msg->width), msg->width, msg->height);
+        if (blurPredictor.drop()){
+            ROS_WARN("NOD = SKIPPING FRAME, PREDICTED MOTION BLUR [%.1fpx]", blurPredictor.getBlur());
+            return;
+        }
+    } else {
+        blurPredictor.clear();
+        if (blurPredictor.isOn()){
+            ROS_WARN_THROTTLE(1, "NOD = No IMU rates available, cannot predict motion blur");
+        }
+    }
+
 
     /// Get Image
     cv_bridge::CvImageConstPtr cvPtr;
@@ -259,16 +361,20 @@ void VoNode::incomingImage(const sensor_msgs::ImageConstPtr& msg){
         return;
     }
 
+    /// Image quality on the raw image, before we spend anything on it
+    const float quality = imageQuality->estimate(cvPtr->image);
+    const bool goodQuality = imageQuality->isGood(quality);
+    const bool draw = pubCamera.getNumSubscribers()>0 || pubImage.getNumSubscribers()>0;
+    if (!goodQuality && !draw){
+        ROS_WARN("NOD = SKIPPING FRAME, BAD QUALITY [%.2f]", quality);
+        return;
+    }
+
     /// GET IMU
     tf::StampedTransform imuStamped;
 
     if (USE_IMU){
-        try{
-            // sent out by the crazyflie driver driver.py
-            subTF.waitForTransform(IMU_FRAME, WORLD_FRAME, msg->header.stamp-imgDelay, ros::Duration(0.1) );
-            subTF.lookupTransform(IMU_FRAME, WORLD_FRAME, msg->header.stamp-imgDelay, imuStamped);
-        } catch(tf::TransformException& ex){
-            ROS_ERROR_THROTTLE(1,"TF exception. Could not get flie IMU transform: %s", ex.what());            
+        if (!getImuAttitude(msg->header.stamp-imgDelay, imuStamped)){
             return;
         }
     } else {
@@ -279,12 +385,18 @@ void VoNode::incomingImage(const sensor_msgs::ImageConstPtr& msg){
 
     /// Make Frame
     ROS_ERROR("MIGHT NEED TO INVERSE IMU");
-    Frame::Ptr frame(new Frame(cvPtr->image, imuStamped));
-
-    if (frame->getQuality()>0.9 || frame->getQuality()<0){
+    // Bad frames are only constructed (preprocess + rectify, no detection) if we need to draw them
+    // Blurry frames might still be processed but with a lower quality, so they do not become keyframes
+    Frame::Ptr frame(new Frame(cvPtr->image, imuStamped, blurPredictor.weight(quality)));
+    frame->setImuRates(gyro, acc);
+    ros::WallTime t1 = ros::WallTime::now();
+    scheduler.addCost(FrameScheduler::ST_FRAME, (t1-t0).toSec());
+
+    if (goodQuality){
         /// Process Frame
         ROS_INFO("NOD > PROCESSING FRAME [%d]", frame->getId());
-        odometry.update(frame);
+        odometry.update(frame, decision==FrameScheduler::FULL);
+        scheduler.addUpdateCost((ros::WallTime::now()-t1).toSec(), frame->getKfId()>=0);
     } else {
         ROS_WARN("NOD = SKIPPING FRAME, BAD QUALITY");
     }
@@ -295,23 +407,34 @@ void VoNode::incomingImage(const sensor_msgs::ImageConstPtr& msg){
 
     /// Clean up and output
     ROS_INFO("NOD < FRAME [%d|%d] PROCESSED [%.1fms, Avg: %.1fms]", frame->getId(), frame->getKfId(), time*1000., timeAvg*1000.);
+    scheduler.printStats();
 
-
-    if (frame->getQuality()>0.9 || frame->getQuality()<0){
+    if (goodQuality){
         publishStuff();
     }
 
     /// publish debug image
-    if (pubCamera.getNumSubscribers()>0 || pubImage.getNumSubscribers()>0){
+    if (draw){
         sensor_msgs::CameraInfoPtr camInfoPtr = frame->getCamInfo();
         cv::Mat drawImg;
-        if (frame->getQuality()>0.9 || frame->getQuality()<0){
+        if (goodQuality){
             drawImg = odometry.getVisualImage();
         } else {
             drawImg = odometry.getVisualImage(frame);
         }
 
         OVO::putInt(drawImg, time*1000., cv::Point(10,drawImg.rows-1*25), CV_RGB(200,0,200), false, "S:");
+        if (quality>=0){
+            OVO::putInt(drawImg, quality*100., cv::Point(10,drawImg.rows-2*25), goodQuality ? CV_RGB(0,200,0) : CV_RGB(200,0,0), false, "Q:", "%");
+        }
+        if (blurPredictor.getBlur()>=0){
+            OVO::putInt(drawImg, blurPredictor.getBlur(), cv::Point(10,drawImg.rows-3*25), CV_RGB(200,0,200), false, "B:", "px");
+        }
+        if (scheduler.isOn()){
+            OVO::putInt(drawImg, scheduler.getSkippedNr(), cv::Point(10,drawImg.rows-4*25), CV_RGB(200,0,200), false, "SK:");
+            OVO::putInt(drawImg, scheduler.getTrackOnlyNr(), cv::Point(10,drawImg.rows-5*25), decision==FrameScheduler::FULL ? CV_RGB(200,0,200) : CV_RGB(200,0,0), false, "TO:");
+        }
+        OVO::putInt(drawImg, scheduler.getDroppedNr(), cv::Point(10,drawImg.rows-6*25), CV_RGB(200,0,200), false, "DR:");
 
 //        if (imageRect.channels() != image.channels()){
 //            cv::cvtColor(imageRect, imageRect,CV_BGR2GRAY);
@@ -367,6 +490,7 @@ ollieRosTools::VoNode_paramsConfig& VoNode::setParameter(ollieRosTools::VoNode_p
     }
 
     imgDelay = ros::Duration(config.imgDelay);
+    imuMaxLate = config.imu_maxLate;
     colorId = config.color;
 
 
@@ -393,6 +517,12 @@ ollieRosTools::VoNode_paramsConfig& VoNode::setParameter(ollieRosTools::VoNode_p
 
     detector->setParameter(config, level);
 
+    imageQuality->setParameter(config, level);
+
+    blurPredictor.setParameter(config, level);
+
+    scheduler.setParameter(config, level);
+
     Frame::setParameter(config, level);
 
     odometry.setParameter(config, level);
@@ -0,0 +1,26 @@
+/****************************************************
+  Nodelet wrapper around VoNode. Subscribes to the preprocessed image of a
+  PreProcNodelet in the same manager without any copy or serialisation.
+  ****************************************************/
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include <boost/shared_ptr.hpp>
+#include <ollieRosTools/VoNode.hpp>
+
+
+class VoNodelet : public nodelet::Nodelet {
+    public:
+        VoNodelet(){}
+
+    private:
+        boost::shared_ptr<VoNode> node;
+
+        virtual void onInit(){
+            NODELET_INFO("Initialising VoNodelet");
+            // VoNode reads all its params from its private namespace, same as the standalone node ("~")
+            node.reset(new VoNode(getPrivateNodeHandle()));
+        }
+};
+
+PLUGINLIB_EXPORT_CLASS(VoNodelet, nodelet::Nodelet)
@@ -1,4 +1,5 @@
 #include <ollieRosTools/aux.hpp>
+#include <Eigen/Eigenvalues>
 
 // Extern var changed once when starting the node depending on the parameters
 // ugly but well..few days left to code..
@@ -182,6 +183,34 @@ void OVO::transformPoints(const Eigen::Affine3d& transform, opengv::points_t& po
     }
 }
 
+// Each bearing u = R*bv (in the world frame) constrains the position t to the ray through the point X: (I-uu')(X-t) = 0
+// => t = (sum (I-uu'))^-1 * sum (I-uu')X
+Eigen::Vector3d OVO::translationKnownRotationAbs(const Eigen::Matrix3d& R, const Bearings& bv, const Points3d& points, const Ints& ind){
+    Eigen::Matrix3d A = Eigen::Matrix3d::Zero();
+    Eigen::Vector3d b = Eigen::Vector3d::Zero();
+    for (uint i=0; i<ind.size(); ++i){
+        const Eigen::Vector3d u = (R*bv[ind[i]]).normalized();
+        const Eigen::Matrix3d P = Eigen::Matrix3d::Identity() - u*u.transpose();
+        A += P;
+        b += P*points[ind[i]];
+    }
+    return A.ldlt().solve(b);
+}
+
+// Epipolar constraint with known rotation: bv1 . (t x R12*bv2) = 0 => t is orthogonal to n = bv1 x R12*bv2
+// => t = eigen vector of sum nn' with the smallest eigen value
+Eigen::Vector3d OVO::translationKnownRotationRel(const Eigen::Matrix3d& R12, const Bearings& bv1, const Bearings& bv2, const Ints& ind){
+    Eigen::Matrix3d A = Eigen::Matrix3d::Zero();
+    for (uint i=0; i<ind.size(); ++i){
+        // Not normalised, so matches with little parallax (unreliable n) get little weight
+        const Eigen::Vector3d n = bv1[ind[i]].cross(R12*bv2[ind[i]]);
+        A += n*n.transpose();
+    }
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> es(A);
+    return es.eigenvectors().col(0);
+}
+
+
 cv::Mat OVO::rotateImage(const cv::Mat& in, const double angleRad, const int interpolation, const double scale, const double thresh) {
     double angleDeg = angleRad * toDeg;
     cv::Mat out;
@@ -315,6 +344,24 @@ double OVO::px2degrees(const double px, const double horiFovDeg, const double wi
     return atan(px/focal_px)*toDeg;
 }
 
+Eigen::Matrix<double, 2, 3> OVO::tangentBasis(const Bearing& bv){
+    const Eigen::Vector3d a = std::abs(bv[0])<0.9 ? Eigen::Vector3d::UnitX() : Eigen::Vector3d::UnitY();
+    const Eigen::Vector3d b1 = bv.cross(a).normalized();
+    Eigen::Matrix<double, 2, 3> B;
+    B.row(0) = b1.transpose();
+    B.row(1) = bv.cross(b1).transpose();
+    return B;
+}
+
+double OVO::error2tangentSq(const double error){
+    const double c = 1.0-error;
+    return std::max(1e-12, 1.0-c*c);
+}
+
+double OVO::px2tangentSq(const double px){
+    return error2tangentSq(px2error(px));
+}
+
 
 
 
@@ -0,0 +1,162 @@
+// Head to head benchmark of the g2o BA (BundleAdjuster) and SchurBA on the same synthetic problem.
+// Keyframes move sideways along a slightly rotating trajectory looking at a cloud of points, like our VO map.
+// The first two keyframes are fixed, the others and all landmarks are perturbed.
+
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+
+#include <ollieRosTools/BundleAdjuster.hpp>
+#include <ollieRosTools/SchurBA.hpp>
+
+using namespace std;
+
+
+static double uniform_rand(double lowerBndr, double upperBndr){
+    return lowerBndr + ((double) std::rand() / (RAND_MAX + 1.0)) * (upperBndr - lowerBndr);
+}
+
+static double gauss_rand(double mean, double sigma){
+    double x, y, r2;
+    do {
+        x = -1.0 + 2.0 * uniform_rand(0.0, 1.0);
+        y = -1.0 + 2.0 * uniform_rand(0.0, 1.0);
+        r2 = x * x + y * y;
+    } while (r2 > 1.0 || r2 == 0.0);
+    return mean + sigma * y * std::sqrt(-2.0 * log(r2) / r2);
+}
+
+static Eigen::Vector3d gauss_vec(double sigma){
+    return Eigen::Vector3d(gauss_rand(0., sigma), gauss_rand(0., sigma), gauss_rand(0., sigma));
+}
+
+
+// Largest keyframe position error vs ground truth
+static double maxKfError(const BAProblem& p, const std::vector<Pose, Eigen::aligned_allocator<Pose> >& gt){
+    double err = 0;
+    for (uint i=0; i<p.kfs.size(); ++i){
+        err = std::max(err, (p.kfs[i].pose.translation()-gt[i].translation()).norm());
+    }
+    return err;
+}
+
+
+int main(int argc, const char* argv[]){
+    if (argc<2){
+        cout << endl;
+        cout << "Please type: " << endl;
+        cout << "ba_bench [NR_KFS] [NR_LMS] [PIXEL_NOISE] [ROBUST_KERNEL] [ITERATIONS] [RUNS]" << endl;
+        cout << endl;
+        cout << "NR_KFS: keyframes (E.g.: 10)" << endl;
+        cout << "NR_LMS: landmarks (default: 3000)" << endl;
+        cout << "PIXEL_NOISE: noise in pixels of a 720px wide 110deg camera (default: 1)" << endl;
+        cout << "ROBUST_KERNEL: use the huber kernel (0 or 1; default: 0==false)" << endl;
+        cout << "ITERATIONS: max iterations (default: 20)" << endl;
+        cout << "RUNS: repetitions averaged over (default: 10)" << endl;
+        cout << endl;
+        exit(0);
+    }
+
+    const int NR_KFS = atoi(argv[1]);
+    const int NR_LMS = argc>2 ? atoi(argv[2]) : 3000;
+    const double PIXEL_NOISE = argc>3 ? atof(argv[3]) : 1.0;
+    const bool ROBUST_KERNEL = argc>4 ? atoi(argv[4]) != 0 : false;
+    const int ITERATIONS = argc>5 ? atoi(argv[5]) : 20;
+    const int RUNS = argc>6 ? atoi(argv[6]) : 10;
+
+    // image plane noise at depth 1
+    const double noise = PIXEL_NOISE * std::tan(110.*toRad*0.5)/360.;
+
+
+    /// Ground truth and perturbed problem
+    std::vector<Pose, Eigen::aligned_allocator<Pose> > gt;
+    BAProblem problem;
+    for (int i=0; i<NR_KFS; ++i){
+        Pose pose = Pose::Identity();
+        pose.linear() = Eigen::AngleAxisd(0.02*i, Eigen::Vector3d::UnitY()).toRotationMatrix();
+        pose.translation() = Eigen::Vector3d(0.3*i, 0.05*i, 0);
+        gt.push_back(pose);
+
+        BAProblem::KF kf;
+        kf.kfId = i;
+        kf.fixed = i<2;
+        kf.pose = pose;
+        if (!kf.fixed){
+            kf.pose.translation() += gauss_vec(0.02);
+            kf.pose.linear() = kf.pose.linear() * Eigen::AngleAxisd(gauss_rand(0., 0.01), gauss_vec(1.).normalized()).toRotationMatrix();
+        }
+        problem.kfs.push_back(kf);
+    }
+
+    for (int j=0; j<NR_LMS; ++j){
+        const Eigen::Vector3d point(uniform_rand(-3., 3.+0.3*NR_KFS), uniform_rand(-3., 3.), uniform_rand(3., 9.));
+        BAProblem::LM lm;
+        lm.id = j;
+        lm.position = point + gauss_vec(0.05);
+        problem.lms.push_back(lm);
+
+        for (int i=0; i<NR_KFS; ++i){
+            const Eigen::Vector3d P = gt[i].inverse() * point;
+            const Eigen::Vector2d px(P[0]/P[2], P[1]/P[2]);
+            // limited field of view and some missed observations
+            if (P[2]<0.1 || px.norm()>1.2 || uniform_rand(0., 1.)<0.3){
+                continue;
+            }
+            BAProblem::Obs obs;
+            obs.kfId = i;
+            obs.lmId = j;
+            obs.measurement = px + Eigen::Vector2d(gauss_rand(0., noise), gauss_rand(0., noise));
+            problem.obs.push_back(obs);
+        }
+    }
+    problem.maxKfId   = NR_KFS-1;
+    problem.maxLmId   = NR_LMS-1;
+    problem.dense     = false;
+    problem.iter      = ITERATIONS;
+    problem.huber     = ROBUST_KERNEL;
+    problem.schur     = false;
+    problem.budget    = 0;
+    problem.gain      = 0;
+    problem.global    = true;
+    problem.outlierChi2 = 0;
+    problem.outlierIter = 0;
+    problem.marginals = false;
+    problem.structure = false;
+    problem.poseGraph = false;
+    problem.time      = 0;
+    problem.iterations= 0;
+    problem.chi2      = 0;
+    problem.nrOutliers= 0;
+
+    cout << "KFS: " << NR_KFS << " LMS: " << NR_LMS << " OBS: " << problem.obs.size() << " PIXEL_NOISE: " << PIXEL_NOISE
+         << " ROBUST_KERNEL: " << ROBUST_KERNEL << " ITERATIONS: " << ITERATIONS << endl;
+    cout << "Initial max KF error: " << maxKfError(problem, gt) << endl;
+
+
+    /// g2o. A fresh adjuster per run so it always builds its graph, as a BA after a new keyframe would
+    double timeG2o = 0;
+    BAProblem resultG2o;
+    for (int r=0; r<RUNS; ++r){
+        resultG2o = problem;
+        BundleAdjuster adjuster;
+        adjuster.solve(resultG2o);
+        timeG2o += resultG2o.time;
+    }
+
+
+    /// SchurBA
+    double timeSchur = 0;
+    BAProblem resultSchur;
+    for (int r=0; r<RUNS; ++r){
+        resultSchur = problem;
+        resultSchur.schur = true;
+        SchurBA schur;
+        schur.solve(resultSchur);
+        timeSchur += resultSchur.time;
+    }
+
+    cout << "g2o:      " << timeG2o/RUNS*1000. << "ms, max KF error: " << maxKfError(resultG2o, gt) << endl;
+    cout << "SchurBA:  " << timeSchur/RUNS*1000. << "ms, max KF error: " << maxKfError(resultSchur, gt) << endl;
+    cout << "Speed up: " << timeG2o/timeSchur << endl;
+    return 0;
+}
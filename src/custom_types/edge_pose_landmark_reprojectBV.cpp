@@ -1,5 +1,6 @@
 #include <ollieRosTools/custom_types/edge_pose_landmark_reprojectBV.hpp>
 #include <ollieRosTools/custom_types/draw_functions.hpp>
+#include <ollieRosTools/custom_types/math_functions.hpp>
 
 bool EdgePoseLandmarkReprojectBV::write(std::ostream& os) const {
     os  << measurement()[0] << " "
@@ -55,6 +56,33 @@ void EdgePoseLandmarkReprojectBV::computeError() {
 
 }
 
+bool EdgePoseLandmarkReprojectBV::isDepthPositive() const {
+    const VertexPose* w_T_cam = static_cast<const VertexPose*>(_vertices[0]);
+    const VertexLandmarkXYZ* P_world = static_cast<const VertexLandmarkXYZ*>(_vertices[1]);
+    return (w_T_cam->estimate().inverse() * P_world->estimate())[2] > 0;
+}
+
+void EdgePoseLandmarkReprojectBV::linearizeOplus() {
+    const VertexPose* w_T_cam = static_cast<const VertexPose*>(_vertices[0]);
+    const VertexLandmarkXYZ* P_world = static_cast<const VertexLandmarkXYZ*>(_vertices[1]);
+
+    const Eigen::Matrix3d Rt = w_T_cam->estimate().rotation().transpose();
+    const Eigen::Vector3d P = Rt * (P_world->estimate() - w_T_cam->estimate().translation());
+    const double zinv = 1.0/P[2];
+
+    // d(error)/dP = -d(projection)/dP
+    Eigen::Matrix<double, 2, 3> Jproj;
+    Jproj << -zinv,     0, P[0]*zinv*zinv,
+                 0, -zinv, P[1]*zinv*zinv;
+
+    // The increment is applied on the right: T*inc. For a small increment P becomes inc^-1*P = P - dt - 2*q x P
+    _jacobianOplusXi.block<2,3>(0,0) = -Jproj;
+    _jacobianOplusXi.block<2,3>(0,3) = 2.0 * Jproj * skew(P);
+
+    // P = R^T * (P_world - t)
+    _jacobianOplusXj = Jproj * Rt;
+}
+
 EdgePoseLandmarkReprojectBVDrawAction::EdgePoseLandmarkReprojectBVDrawAction(): g2o::DrawAction(typeid(EdgePoseLandmarkReprojectBV).name()) {
 
 }
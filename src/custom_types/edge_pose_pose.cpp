@@ -64,6 +64,35 @@ void EdgePosePose::computeError() {
     _error = fromIsometry(w_T_a->estimate() * _measurement * w_T_b->estimate().inverse());
 }
 
+void EdgePosePose::linearizeOplus() {
+    const VertexPose* w_T_a = static_cast<const VertexPose*>(_vertices[0]);
+    const VertexPose* w_T_b = static_cast<const VertexPose*>(_vertices[1]);
+
+    // E = A*M*B^-1, the error is its translation and the vector part of its normalised quaternion
+    const Eigen::Isometry3d& A = w_T_a->estimate();
+    const Eigen::Isometry3d& B = w_T_b->estimate();
+    const Eigen::Isometry3d E = A * _measurement * B.inverse();
+    const Eigen::Matrix3d Ra = A.rotation();
+    const Eigen::Matrix3d Rb = B.rotation();
+    const Eigen::Matrix3d Re = E.rotation();
+    Eigen::Quaterniond q(Re);
+    q.normalize();
+    const Eigen::Matrix3d qv = skew(q.vec());
+    const Eigen::Matrix3d qw = q.w()*Eigen::Matrix3d::Identity();
+
+    // A*inc: the rotation increment acts as a left perturbation of E by Ra*dq
+    _jacobianOplusXi.setZero();
+    _jacobianOplusXi.block<3,3>(0,0) = Ra;
+    _jacobianOplusXi.block<3,3>(0,3) = 2.0 * skew(A.translation()-E.translation()) * Ra;
+    _jacobianOplusXi.block<3,3>(3,3) = (qw - qv) * Ra;
+
+    // inc^-1*B^-1: the rotation increment acts as a right perturbation of E by -Rb*dq
+    _jacobianOplusXj.setZero();
+    _jacobianOplusXj.block<3,3>(0,0) = -Re * Rb;
+    _jacobianOplusXj.block<3,3>(0,3) = -2.0 * Re * skew(B.translation()) * Rb;
+    _jacobianOplusXj.block<3,3>(3,3) = -(qw + qv) * Rb;
+}
+
 EdgePosePoseDrawAction::EdgePosePoseDrawAction(): g2o::DrawAction(typeid(EdgePosePose).name()) {}
 
 bool EdgePosePoseDrawAction::refreshPropertyPtrs(HyperGraphElementAction::Parameters* params_) {
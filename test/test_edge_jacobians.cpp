@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <cmath>
+
+#include <gtest/gtest.h>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include <ollieRosTools/custom_types/edge_pose_landmark_reprojectBV.hpp>
+#include <ollieRosTools/custom_types/edge_pose_pose.hpp>
+
+
+
+/// Checks the analytic jacobians of the custom g2o edges against central differences of computeError() over the
+/// oplus increments of their vertices, on random poses
+
+static const int TRIALS = 100;
+static const double STEP = 1e-6;
+static const double TOL = 1e-5; // relative to the largest jacobian entry
+
+
+
+// Random rotation, translation within +-range
+static Eigen::Isometry3d randomPose(const double range){
+    Eigen::Isometry3d T;
+    T = Eigen::Quaterniond(Eigen::Vector4d::Random().normalized()).toRotationMatrix();
+    T.translation() = range*Eigen::Vector3d::Random();
+    return T;
+}
+
+// Rotation of at most maxAngle radians around a random axis, translation within +-range
+static Eigen::Isometry3d randomSmallPose(const double maxAngle, const double range){
+    Eigen::Isometry3d T;
+    T = Eigen::AngleAxisd(maxAngle*std::abs(Eigen::Vector2d::Random()[0]), Eigen::Vector3d::Random().normalized()).toRotationMatrix();
+    T.translation() = range*Eigen::Vector3d::Random();
+    return T;
+}
+
+// d(error)/d(increment of v) by central differences
+template <class EDGE, int D>
+static Eigen::Matrix<double, EDGE::Dimension, D> numericJacobian(EDGE& e, g2o::OptimizableGraph::Vertex* v){
+    Eigen::Matrix<double, EDGE::Dimension, D> J;
+    for (int i=0; i<D; ++i){
+        double inc[D];
+        std::fill(inc, inc+D, 0.);
+
+        inc[i] = STEP;
+        v->push();
+        v->oplus(inc);
+        e.computeError();
+        const typename EDGE::ErrorVector plus = e.error();
+        v->pop();
+
+        inc[i] = -STEP;
+        v->push();
+        v->oplus(inc);
+        e.computeError();
+        const typename EDGE::ErrorVector minus = e.error();
+        v->pop();
+
+        J.col(i) = (plus-minus)/(2.*STEP);
+    }
+    e.computeError();
+    return J;
+}
+
+template <class M1, class M2>
+static double relativeDifference(const M1& analytic, const M2& numeric){
+    return (analytic-numeric).cwiseAbs().maxCoeff() / std::max(1.0, numeric.cwiseAbs().maxCoeff());
+}
+
+
+
+TEST(EdgeJacobians, PoseLandmarkReprojectBV){
+    for (int trial=0; trial<TRIALS; ++trial){
+        VertexPose pose;
+        pose.setId(0);
+        pose.setEstimate(randomPose(5));
+
+        // landmark in front of the camera, measured with some error
+        const Eigen::Vector3d Pcam(Eigen::Vector2d::Random()[0], Eigen::Vector2d::Random()[0], 2.+3.*std::abs(Eigen::Vector2d::Random()[0]));
+        VertexLandmarkXYZ lm;
+        lm.setId(1);
+        lm.setEstimate(pose.estimate()*Pcam);
+
+        EdgePoseLandmarkReprojectBV e;
+        e.setVertex(0, &pose);
+        e.setVertex(1, &lm);
+        e.setMeasurement(Eigen::Vector2d(Pcam[0]/Pcam[2], Pcam[1]/Pcam[2]) + 0.01*Eigen::Vector2d::Random());
+        e.setInformation(Eigen::Matrix2d::Identity());
+        ASSERT_TRUE(e.isDepthPositive());
+
+        e.computeError();
+        e.linearizeOplus();
+        EXPECT_LT(relativeDifference(e.jacobianOplusXi(), (numericJacobian<EdgePoseLandmarkReprojectBV, 6>(e, &pose))), TOL) << "trial " << trial;
+        EXPECT_LT(relativeDifference(e.jacobianOplusXj(), (numericJacobian<EdgePoseLandmarkReprojectBV, 3>(e, &lm))), TOL) << "trial " << trial;
+    }
+}
+
+
+
+TEST(EdgeJacobians, PosePose){
+    for (int trial=0; trial<TRIALS; ++trial){
+        VertexPose a;
+        a.setId(0);
+        a.setEstimate(randomPose(5));
+        VertexPose b;
+        b.setId(1);
+        b.setEstimate(randomPose(5));
+
+        // measurement off by a small random pose, so the error is not zero
+        EdgePosePose e;
+        e.setVertex(0, &a);
+        e.setVertex(1, &b);
+        e.setMeasurement(a.estimate().inverse() * randomSmallPose(0.3, 0.1) * b.estimate());
+        e.setInformation(Eigen::Matrix<double, 6, 6>::Identity());
+
+        e.computeError();
+        e.linearizeOplus();
+        EXPECT_LT(relativeDifference(e.jacobianOplusXi(), (numericJacobian<EdgePosePose, 6>(e, &a))), TOL) << "trial " << trial;
+        EXPECT_LT(relativeDifference(e.jacobianOplusXj(), (numericJacobian<EdgePosePose, 6>(e, &b))), TOL) << "trial " << trial;
+    }
+}
+
+
+
+int main(int argc, char **argv){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}